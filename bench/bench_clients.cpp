@@ -0,0 +1,58 @@
+// Client lookup: the registry's hash index against the linear scan over a
+// vector of frame/client pairs that it replaced, for growing client counts.
+#include <X11/Xlib.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "../client.h"
+
+struct WindowPair {
+    Window frame;
+    Window client;
+    GC gc;
+};
+
+static WindowPair* linear_find(std::vector<WindowPair>& pairs, Window w) {
+    for (auto& wp : pairs) {
+        if (wp.frame == w || wp.client == w) return &wp;
+    }
+    return nullptr;
+}
+
+int main() {
+    const int lookups = 2000000;
+    const int counts[] = { 4, 16, 64, 256, 1024 };
+    int first = 0;
+
+    printf("%8s %14s %14s\n", "clients", "linear ns/op", "registry ns/op");
+    for (int count : counts) {
+        std::vector<WindowPair> pairs;
+        for (int i = 0; i < count; ++i) {
+            Window frame = 0x1000000 + first + 2 * i;
+            Window client = frame + 1;
+            pairs.push_back({frame, client, nullptr});
+            add_client(frame, client, nullptr, 0, 0, 100, 100);
+        }
+
+        // Look up client XIDs spread across the whole set, the common case
+        // for PropertyNotify and ConfigureNotify.
+        std::vector<Window> keys;
+        for (int i = 0; i < 1024; ++i) keys.push_back(pairs[(i * 7919) % count].client);
+
+        size_t hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < lookups; ++i) hits += linear_find(pairs, keys[i & 1023]) != nullptr;
+        auto mid = std::chrono::steady_clock::now();
+        for (int i = 0; i < lookups; ++i) hits += find_client(keys[i & 1023]) != nullptr;
+        auto end = std::chrono::steady_clock::now();
+
+        double linear = std::chrono::duration<double, std::nano>(mid - start).count() / lookups;
+        double registry = std::chrono::duration<double, std::nano>(end - mid).count() / lookups;
+        printf("%8d %14.1f %14.1f%s\n", count, linear, registry, hits == 2u * lookups ? "" : "  (missed)");
+
+        for (const WindowPair& wp : pairs) remove_client(find_client(wp.frame));
+        first += 2 * count;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Wallpaper pixel conversion: per-pixel XPutPixel against the row kernels
+// in pixel.cpp, on one 1920x1080 frame. XPutPixel runs on a client-side
+// XImage, so no X server is needed.
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../pixel.h"
+
+static const int width = 1920;
+static const int height = 1080;
+static const int rounds = 20;
+
+template <typename F>
+static double time_ms(F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+int main() {
+    std::vector<unsigned char> src((size_t)width * height * 4);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = (unsigned char)(i * 31 + 7);
+
+    std::vector<uint32_t> dst((size_t)width * height);
+
+    XImage img = {};
+    img.width = width;
+    img.height = height;
+    img.format = ZPixmap;
+    img.data = (char*)dst.data();
+    img.byte_order = LSBFirst;
+    img.bitmap_unit = 32;
+    img.bitmap_bit_order = LSBFirst;
+    img.bitmap_pad = 32;
+    img.depth = 24;
+    img.bytes_per_line = width * 4;
+    img.bits_per_pixel = 32;
+    img.red_mask = 0xff0000;
+    img.green_mask = 0xff00;
+    img.blue_mask = 0xff;
+    if (!XInitImage(&img)) {
+        fprintf(stderr, "XInitImage failed\n");
+        return 1;
+    }
+
+    double putpixel = time_ms([&]() {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const unsigned char* p = &src[((size_t)y * width + x) * 4];
+                XPutPixel(&img, x, y, ((unsigned long)p[0] << 16) | (p[1] << 8) | p[2]);
+            }
+        }
+    });
+    std::vector<uint32_t> reference = dst;
+
+    printf("%-10s %8.2f ms/frame\n", "XPutPixel", putpixel);
+
+    struct Kernel {
+        const char* name;
+        ConvertRow convert;
+    };
+    std::vector<Kernel> kernels = { { "scalar", rgba_to_xrgb_scalar } };
+#if defined(__SSE2__)
+    kernels.push_back({ "sse2", rgba_to_xrgb_sse2 });
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) kernels.push_back({ "avx2", rgba_to_xrgb_avx2 });
+#endif
+
+    for (const Kernel& k : kernels) {
+        memset(dst.data(), 0, dst.size() * 4);
+        double ms = time_ms([&]() {
+            for (int y = 0; y < height; ++y) {
+                k.convert(&src[(size_t)y * width * 4], &dst[(size_t)y * width], width);
+            }
+        });
+        bool same = dst == reference;
+        printf("%-10s %8.2f ms/frame  %5.1fx%s\n", k.name, ms, putpixel / ms, same ? "" : "  MISMATCH");
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Key-press-to-exec latency: time from the call until the child has exec'd,
+// for launch() against the fork + setenv + sh -c launcher it replaced, with
+// a small and a large WM address space. exec is detected through a
+// close-on-exec pipe that hits EOF once the child's image is replaced.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../launch.h"
+
+static const int runs = 200;
+
+static void fork_launch(const char* cmd, int px, int py, const char* display_name) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setsid();
+        if (display_name) setenv("DISPLAY", display_name, 1);
+        const char* xauth = getenv("XAUTHORITY");
+        if (xauth) setenv("XAUTHORITY", xauth, 1);
+        char bufx[32], bufy[32];
+        snprintf(bufx, sizeof(bufx), "%d", px);
+        snprintf(bufy, sizeof(bufy), "%d", py);
+        setenv("PRISM_LAUNCH_X", bufx, 1);
+        setenv("PRISM_LAUNCH_Y", bufy, 1);
+        int fd = open("/tmp/prism.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd == -1) fd = open("/dev/null", O_WRONLY);
+        if (fd != -1) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            if (fd > 2) close(fd);
+        }
+        execlp("sh", "sh", "-c", cmd, nullptr);
+        std::exit(1);
+    }
+}
+
+template <typename F>
+static double median_us(F start_child) {
+    std::vector<double> samples;
+    for (int i = 0; i < runs; ++i) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+
+        auto start = std::chrono::steady_clock::now();
+        start_child();
+        close(fds[1]);
+        char c;
+        while (read(fds[0], &c, 1) > 0) {}
+        auto end = std::chrono::steady_clock::now();
+        close(fds[0]);
+
+        samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        while (waitpid(-1, nullptr, 0) > 0) {}
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+static void run(const char* label) {
+    printf("%s\n", label);
+    printf("  %-28s %8.1f us\n", "fork + sh -c true", median_us([]() { fork_launch("true", 0, 0, ":0"); }));
+    printf("  %-28s %8.1f us\n", "launch(\"true\")  [direct]", median_us([]() { launch("true", 0, 0, ":0"); }));
+    printf("  %-28s %8.1f us\n", "launch(\"true;\") [sh -c]", median_us([]() { launch("true;", 0, 0, ":0"); }));
+}
+
+int main() {
+    run("small address space");
+
+    // Roughly what the WM holds right after decoding a large wallpaper.
+    size_t size = 256u << 20;
+    char* ballast = (char*)malloc(size);
+    memset(ballast, 1, size);
+    run("with 256 MB resident");
+    free(ballast);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include "client.h"
+
+#include <list>
+#include <unordered_map>
+
+// Clients live in a list so pointers stay valid and _NET_CLIENT_LIST keeps
+// mapping order; the index resolves both frame and client XIDs in O(1).
+static std::list<Client> clients;
+static std::unordered_map<Window, std::list<Client>::iterator> client_index;
+
+Client* add_client(Window frame, Window window, GC gc, int x, int y, int width, int height) {
+    clients.push_back({frame, window, gc, x, y, width, height, false, nullptr, std::string(), 0});
+    auto it = std::prev(clients.end());
+    client_index[window] = it;
+    if (frame != None) client_index[frame] = it;
+    return &*it;
+}
+
+void remove_client(Client* c) {
+    auto found = client_index.find(c->window);
+    if (found == client_index.end()) return;
+
+    auto it = found->second;
+    client_index.erase(found);
+    if (it->frame != None) client_index.erase(it->frame);
+    clients.erase(it);
+}
+
+Client* find_client(Window w) {
+    auto it = client_index.find(w);
+    if (it == client_index.end()) return nullptr;
+    return &*it->second;
+}
+
+std::list<Client>& all_clients() {
+    return clients;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+#include <list>
+#include <string>
+
+struct Client {
+    Window frame;   // None for undecorated clients
+    Window window;
+    GC gc;
+
+    // Last known geometry of the top-level window (frame if decorated),
+    // kept current from ConfigureNotify/MapNotify/UnmapNotify.
+    int x, y;
+    int width, height;
+    bool mapped;
+
+    // Title bar rendering state, refreshed only when WM_NAME changes.
+    XftDraw* draw;
+    std::string title;
+    int title_width;
+};
+
+Client* add_client(Window frame, Window window, GC gc, int x, int y, int width, int height);
+void remove_client(Client* c);
+Client* find_client(Window w);
+std::list<Client>& all_clients();
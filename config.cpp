@@ -5,17 +5,27 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/inotify.h>
+#include <cstring>
 #include <pwd.h>
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <X11/cursorfont.h>
+#include <X11/keysym.h>
 
 #include "paper.h"
 #include "config.h"
+#include "window.h"
+#include "keys.h"
+#include "launch.h"
 
 std::string xrandr_command;
+std::string wallpaper_path;
+WallpaperMode wallpaper_mode = WALLPAPER_STRETCH;
+bool wallpaper_span = false;
 std::vector<std::string> startup_commands;
-std::map<std::pair<int, unsigned int>, std::string> keybindings;
+std::vector<std::string> respawn_commands;
 
 
 void ensure_config_exists(const std::string& path) {
@@ -34,15 +44,25 @@ void ensure_config_exists(const std::string& path) {
     std::ofstream out(path);
     out << "# Wallpaper set here\n";
     out << "wallpaper=~/Pictures/wallpaper.png\n";
+    out << "# fill, fit, center, tile or stretch; span=true lays one image across all monitors\n";
+    out << "# wallpaper_mode=fill\n";
+    out << "# wallpaper_span=true\n";
 
     out << "\n# Startup apps here\n";
     out << "\n# Uncomment this and install a polkit agent if you want to have permissions in certain apps\n";
     out << "# If you would like to use this example (sudo pacman -S polkit-gnome)\n";
     out << "# /usr/lib/polkit-gnome/polkit-gnome-authentication-agent-1\n";
+    out << "# Prefix with respawn= to start it again if it dies\n";
+    out << "# respawn=/usr/lib/polkit-gnome/polkit-gnome-authentication-agent-1\n";
 
     out << "\n# Example keybindings\n";
+    out << "# Values are a shell command, or one of: close, maximize, fullscreen,\n";
+    out << "# focus-next, lock, reload, move-to-monitor <n|next>, exec <cmd>, exec-raw <argv>\n";
     out << "Mod4+B=firefox\n";
     out << "Mod4+T=alacritty\n";
+    out << "Mod4+L=lock\n";
+    out << "Mod4+Q=close\n";
+    out << "Mod4+F=fullscreen\n";
     out << "# Uncomment for rofi\n";
     out << "# Mod4+R=rofi -show drun\n";
 
@@ -55,9 +75,26 @@ void ensure_config_exists(const std::string& path) {
 }
 
 
-void load_config(Display* dpy, Window root) {
-    std::string path = get_config_path();
-    ensure_config_exists(path);
+static bool parse_wallpaper_mode(const std::string& name, WallpaperMode* mode) {
+    if (name == "stretch") *mode = WALLPAPER_STRETCH;
+    else if (name == "fill") *mode = WALLPAPER_FILL;
+    else if (name == "fit") *mode = WALLPAPER_FIT;
+    else if (name == "center") *mode = WALLPAPER_CENTER;
+    else if (name == "tile") *mode = WALLPAPER_TILE;
+    else return false;
+    return true;
+}
+
+// Parses the config into the globals above and bindings, starting from the
+// defaults so a reload drops keys that were removed from the file.
+static void read_config(Display* dpy, const std::string& path, std::vector<KeyBinding>& bindings) {
+    xrandr_command.clear();
+    wallpaper_path.clear();
+    wallpaper_mode = WALLPAPER_STRETCH;
+    wallpaper_span = false;
+    startup_commands.clear();
+    respawn_commands.clear();
+
     std::ifstream file(path);
     std::string line;
     while (std::getline(file, line)) {
@@ -82,7 +119,24 @@ void load_config(Display* dpy, Window root) {
                     full_path = std::string(home) + full_path.substr(1);
                 }
 
-                setpaper(full_path);
+                wallpaper_path = full_path;
+                continue;
+            }
+
+            if (combo == "respawn") {
+                respawn_commands.push_back(command);
+                continue;
+            }
+
+            if (combo == "wallpaper_mode") {
+                if (!parse_wallpaper_mode(command, &wallpaper_mode)) {
+                    std::cerr << "prism: unknown wallpaper_mode " << command << "\n";
+                }
+                continue;
+            }
+
+            if (combo == "wallpaper_span") {
+                wallpaper_span = command == "true" || command == "yes" || command == "1";
                 continue;
             }
 
@@ -98,15 +152,116 @@ void load_config(Display* dpy, Window root) {
                 }
             }
             KeyCode kc = XKeysymToKeycode(dpy, XStringToKeysym(keyname.c_str()));
-            if (kc) {
-                keybindings[{kc, mods}] = command;
-                XGrabKey(dpy, kc, mods, root, True, GrabModeAsync, GrabModeAsync);
-            }
+            Action action;
+            if (kc && parse_action(command, &action)) add_keybinding(bindings, kc, mods, action);
             continue;
         }
 
         startup_commands.push_back(line);
     }
+
+    // Configs written before lock became an action still get Mod4+L.
+    KeyCode lock_key = XKeysymToKeycode(dpy, XK_l);
+    bool has_lock = false;
+    bool lock_key_bound = false;
+    for (const KeyBinding& b : bindings) {
+        if (b.action.type == ACTION_LOCK) has_lock = true;
+        if (b.keycode == lock_key && b.mods == Mod4Mask) lock_key_bound = true;
+    }
+    if (lock_key && !has_lock && !lock_key_bound) {
+        add_keybinding(bindings, lock_key, Mod4Mask, {ACTION_LOCK, "", {}, -1});
+    }
+}
+
+// What the current wallpaper was rendered from, so a reload can tell
+// whether it needs rendering again.
+static std::string applied_wallpaper;
+static struct timespec applied_wallpaper_mtime;
+static WallpaperMode applied_wallpaper_mode;
+static bool applied_wallpaper_span;
+
+// Runs after the whole file is read so the mode keys apply no matter where
+// they appear relative to wallpaper=.
+static void apply_wallpaper(bool force) {
+    if (wallpaper_path.empty()) return;
+
+    struct timespec mtime = {};
+    struct stat st;
+    if (stat(wallpaper_path.c_str(), &st) == 0) mtime = st.st_mtim;
+
+    bool unchanged = wallpaper_path == applied_wallpaper &&
+                     mtime.tv_sec == applied_wallpaper_mtime.tv_sec &&
+                     mtime.tv_nsec == applied_wallpaper_mtime.tv_nsec &&
+                     wallpaper_mode == applied_wallpaper_mode &&
+                     wallpaper_span == applied_wallpaper_span;
+    if (unchanged && !force) return;
+
+    applied_wallpaper = wallpaper_path;
+    applied_wallpaper_mtime = mtime;
+    applied_wallpaper_mode = wallpaper_mode;
+    applied_wallpaper_span = wallpaper_span;
+    setpaper(wallpaper_path);
+}
+
+static int config_watch_fd = -1;
+
+// Watches the config directory rather than the file, since most editors
+// save by writing a new file and renaming it over the old one.
+static void watch_config(const std::string& path) {
+    config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (config_watch_fd == -1) return;
+
+    std::string dir = path.substr(0, path.rfind('/'));
+    if (inotify_add_watch(config_watch_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        close(config_watch_fd);
+        config_watch_fd = -1;
+    }
+}
+
+void load_config(Display* dpy, Window root) {
+    std::string path = get_config_path();
+    ensure_config_exists(path);
+
+    std::vector<KeyBinding> bindings;
+    read_config(dpy, path, bindings);
+    apply_keybindings(dpy, root, bindings);
+    apply_wallpaper(true);
+
+    watch_config(path);
+}
+
+int config_fd() {
+    return config_watch_fd;
+}
+
+// Called from the event loop when config_fd() is readable. startup_commands
+// and xrandr= are picked up but not run again.
+void handle_config_change(Display* dpy, Window root) {
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+
+    ssize_t len;
+    while ((len = read(config_watch_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            if (ev->len > 0 && strcmp(ev->name, "config") == 0) changed = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (changed) reload_config(dpy, root);
+}
+
+void reload_config(Display* dpy, Window root) {
+    std::string path = get_config_path();
+    std::ifstream probe(path);
+    if (!probe.good()) return;
+
+    std::vector<KeyBinding> bindings;
+    read_config(dpy, path, bindings);
+    apply_keybindings(dpy, root, bindings);
+    apply_wallpaper(false);
+    sync_respawn_commands(respawn_commands, display_name);
+    std::cerr << "prism: reloaded " << path << "\n";
 }
 
 std::string get_config_path() {
@@ -134,7 +289,7 @@ void show_config_created_bar(const std::string& message) {
     GC gc = XCreateGC(display, bar, 0, nullptr);
     XSetForeground(display, gc, BlackPixel(display, screen));
 
-    Atom wm_delete = XInternAtom(display, "WM_DELETE_WINDOW", False);
+    Atom wm_delete = wm_atoms[WM_DELETE_WINDOW];
     XSetWMProtocols(display, bar, &wm_delete, 1);
 
     XEvent ev;
@@ -1,12 +1,17 @@
 #pragma once
 
 extern Display* display;
+extern const char* display_name;
 int parse_modifier(const std::string& mod); 
 
 extern std::string xrandr_command;
+extern std::string wallpaper_path;
 extern std::vector<std::string> startup_commands;
-extern std::map<std::pair<int, unsigned int>, std::string> keybindings;
+extern std::vector<std::string> respawn_commands;
 
 void load_config(Display* dpy, Window root);
+int config_fd();
+void handle_config_change(Display* dpy, Window root);
+void reload_config(Display* dpy, Window root);
 std::string get_config_path();
 void show_config_created_bar(const std::string& message);
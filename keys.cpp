@@ -0,0 +1,136 @@
+#include "keys.h"
+
+#include <X11/keysym.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+std::vector<KeyBinding> keybindings;
+
+// Bindings only care about these; lock modifiers (NumLock, CapsLock) are
+// ignored by grabbing every combination of them and masking them off here.
+static const unsigned int binding_mods = ShiftMask | ControlMask | Mod1Mask | Mod4Mask;
+
+// keycode x modifier combination -> 1 + index into keybindings, 0 if unbound.
+static uint16_t key_table[256][16];
+
+static int mod_index(unsigned int state) {
+    return ((state & ShiftMask) ? 1 : 0) | ((state & ControlMask) ? 2 : 0) |
+           ((state & Mod1Mask) ? 4 : 0) | ((state & Mod4Mask) ? 8 : 0);
+}
+
+static unsigned int find_numlock_mask(Display* dpy) {
+    unsigned int mask = 0;
+    KeyCode numlock = XKeysymToKeycode(dpy, XK_Num_Lock);
+    XModifierKeymap* modmap = XGetModifierMapping(dpy);
+    if (!modmap) return 0;
+
+    for (int mod = 0; mod < 8; ++mod) {
+        for (int k = 0; k < modmap->max_keypermod; ++k) {
+            if (numlock && modmap->modifiermap[mod * modmap->max_keypermod + k] == numlock) {
+                mask = 1u << mod;
+            }
+        }
+    }
+    XFreeModifiermap(modmap);
+    return mask;
+}
+
+// Turns a binding's value into an Action. Values that don't start with an
+// action name are run through the shell as before, so plain commands like
+// "firefox" keep working.
+bool parse_action(const std::string& text, Action* action) {
+    size_t space = text.find(' ');
+    std::string name = text.substr(0, space);
+    std::string arg;
+    size_t arg_start = text.find_first_not_of(' ', name.size());
+    if (space != std::string::npos && arg_start != std::string::npos) arg = text.substr(arg_start);
+
+    *action = Action{ACTION_EXEC, text, {}, -1};
+
+    if (name == "close") action->type = ACTION_CLOSE;
+    else if (name == "maximize") action->type = ACTION_MAXIMIZE;
+    else if (name == "fullscreen") action->type = ACTION_FULLSCREEN;
+    else if (name == "focus-next") action->type = ACTION_FOCUS_NEXT;
+    else if (name == "lock") action->type = ACTION_LOCK;
+    else if (name == "reload") action->type = ACTION_RELOAD;
+    else if (name == "exec") action->command = arg;
+    else if (name == "move-to-monitor") {
+        action->type = ACTION_MOVE_TO_MONITOR;
+        if (arg != "next") {
+            char* end;
+            long index = strtol(arg.c_str(), &end, 10);
+            if (arg.empty() || *end != '\0' || index < 0) {
+                std::cerr << "prism: move-to-monitor needs a monitor number or next: " << text << "\n";
+                return false;
+            }
+            action->monitor = (int)index;
+        }
+    } else if (name == "exec-raw") {
+        action->type = ACTION_EXEC_RAW;
+        std::istringstream words(arg);
+        std::string word;
+        while (words >> word) action->argv.push_back(word);
+        if (action->argv.empty()) {
+            std::cerr << "prism: exec-raw needs a command: " << text << "\n";
+            return false;
+        }
+    }
+
+    if (action->type == ACTION_EXEC && action->command.empty()) return false;
+    return true;
+}
+
+static const KeyBinding* find_binding(const std::vector<KeyBinding>& list, KeyCode keycode, unsigned int mods) {
+    for (const KeyBinding& b : list) {
+        if (b.keycode == keycode && b.mods == mods) return &b;
+    }
+    return nullptr;
+}
+
+void add_keybinding(std::vector<KeyBinding>& list, KeyCode keycode, unsigned int mods, const Action& action) {
+    mods &= binding_mods;
+    for (KeyBinding& b : list) {
+        if (b.keycode == keycode && b.mods == mods) {
+            b.action = action;
+            return;
+        }
+    }
+    list.push_back({keycode, mods, action});
+}
+
+// Makes next the active binding set. Only keys that were added or dropped
+// are grabbed or ungrabbed, each under every NumLock/CapsLock combination;
+// the requests are queued without a round trip. Changing what an existing
+// key does only touches the dispatch table.
+void apply_keybindings(Display* dpy, Window root, const std::vector<KeyBinding>& next) {
+    unsigned int numlock = find_numlock_mask(dpy);
+    const unsigned int lock_combos[] = { 0, LockMask, numlock, LockMask | numlock };
+    const int combo_count = numlock ? 4 : 2;
+
+    for (const KeyBinding& b : keybindings) {
+        if (find_binding(next, b.keycode, b.mods)) continue;
+        for (int c = 0; c < combo_count; ++c) XUngrabKey(dpy, b.keycode, b.mods | lock_combos[c], root);
+    }
+    for (const KeyBinding& b : next) {
+        if (find_binding(keybindings, b.keycode, b.mods)) continue;
+        for (int c = 0; c < combo_count; ++c) {
+            XGrabKey(dpy, b.keycode, b.mods | lock_combos[c], root, True, GrabModeAsync, GrabModeAsync);
+        }
+    }
+
+    keybindings = next;
+    memset(key_table, 0, sizeof(key_table));
+    for (size_t i = 0; i < keybindings.size(); ++i) {
+        const KeyBinding& b = keybindings[i];
+        key_table[b.keycode][mod_index(b.mods)] = (uint16_t)(i + 1);
+    }
+    XFlush(dpy);
+}
+
+const Action* lookup_key_action(KeyCode keycode, unsigned int state) {
+    uint16_t slot = key_table[keycode][mod_index(state & binding_mods)];
+    return slot ? &keybindings[slot - 1].action : nullptr;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <X11/Xlib.h>
+#include <string>
+#include <vector>
+
+enum ActionType {
+    ACTION_EXEC,            // command through sh -c
+    ACTION_EXEC_RAW,        // argv exec'd directly, no shell
+    ACTION_CLOSE,
+    ACTION_MAXIMIZE,
+    ACTION_FULLSCREEN,
+    ACTION_MOVE_TO_MONITOR,
+    ACTION_FOCUS_NEXT,
+    ACTION_LOCK,
+    ACTION_RELOAD,
+};
+
+// What a binding does, parsed once when the config is read.
+struct Action {
+    ActionType type;
+    std::string command;
+    std::vector<std::string> argv;
+    int monitor;            // move-to-monitor target, -1 for the next one
+};
+
+struct KeyBinding {
+    KeyCode keycode;
+    unsigned int mods;
+    Action action;
+};
+
+extern std::vector<KeyBinding> keybindings;
+
+bool parse_action(const std::string& text, Action* action);
+void add_keybinding(std::vector<KeyBinding>& list, KeyCode keycode, unsigned int mods, const Action& action);
+void apply_keybindings(Display* dpy, Window root, const std::vector<KeyBinding>& next);
+const Action* lookup_key_action(KeyCode keycode, unsigned int state);
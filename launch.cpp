@@ -1,28 +1,282 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
 #include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
 
-void launch(const char* cmd, int px, int py, const char* display_name) {
-    pid_t pid = fork();
-    if (pid == 0) {
-        setsid();
-        if (display_name) setenv("DISPLAY", display_name, 1);
-        const char* xauth = getenv("XAUTHORITY");
-        if (xauth) setenv("XAUTHORITY", xauth, 1);
-        char bufx[32], bufy[32];
-        snprintf(bufx, sizeof(bufx), "%d", px);
-        snprintf(bufy, sizeof(bufy), "%d", py);
-        setenv("PRISM_LAUNCH_X", bufx, 1);
-        setenv("PRISM_LAUNCH_Y", bufy, 1);
-        int fd = open("/tmp/prism.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (fd == -1) fd = open("/dev/null", O_WRONLY);
-        if (fd != -1) {
-            dup2(fd, STDOUT_FILENO);
-            dup2(fd, STDERR_FILENO);
-            if (fd > 2) close(fd);
+#include "launch.h"
+
+extern char** environ;
+
+// Environment for children: the WM's own, with DISPLAY and XAUTHORITY
+// pinned. Built on the first launch instead of setenv'ing in every child.
+static std::vector<std::string> base_env;
+static std::string base_env_display;
+static bool base_env_ready = false;
+
+static bool is_launch_var(const char* entry) {
+    static const char* const names[] = { "DISPLAY=", "XAUTHORITY=", "PRISM_LAUNCH_X=", "PRISM_LAUNCH_Y=" };
+    for (const char* name : names) {
+        if (strncmp(entry, name, strlen(name)) == 0) return true;
+    }
+    return false;
+}
+
+static void build_base_env(const char* display_name) {
+    base_env.clear();
+    for (char** e = environ; *e; ++e) {
+        if (!is_launch_var(*e)) base_env.push_back(*e);
+    }
+    if (display_name) base_env.push_back(std::string("DISPLAY=") + display_name);
+    const char* xauth = getenv("XAUTHORITY");
+    if (xauth) base_env.push_back(std::string("XAUTHORITY=") + xauth);
+
+    base_env_display = display_name ? display_name : "";
+    base_env_ready = true;
+}
+
+// Commands made only of plain words can be exec'd without a shell.
+static bool needs_shell(const char* cmd) {
+    return strpbrk(cmd, "|&;<>()$`\\\"'*?[]#~=%{}!\n\t") != nullptr;
+}
+
+// Children's stdout and stderr, opened once by the WM. Falls back to
+// /dev/null when the log can't be written.
+static int log_fd = -1;
+
+static int open_child_log() {
+    if (log_fd != -1) return log_fd;
+    log_fd = open("/tmp/prism.log", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd == -1) log_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    return log_fd;
+}
+
+static pid_t spawn(const std::vector<std::string>& argv, int px, int py, const char* display_name) {
+    if (!base_env_ready || base_env_display != (display_name ? display_name : "")) {
+        build_base_env(display_name);
+    }
+
+    std::string launch_x = "PRISM_LAUNCH_X=" + std::to_string(px);
+    std::string launch_y = "PRISM_LAUNCH_Y=" + std::to_string(py);
+
+    std::vector<char*> envp;
+    envp.reserve(base_env.size() + 3);
+    for (std::string& entry : base_env) envp.push_back(&entry[0]);
+    envp.push_back(&launch_x[0]);
+    envp.push_back(&launch_y[0]);
+    envp.push_back(nullptr);
+
+    std::vector<char*> args;
+    for (const std::string& arg : argv) args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    int fd = open_child_log();
+    if (fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, fd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, fd, STDERR_FILENO);
+    }
+
+    // The WM blocks SIGCHLD and traps SIGINT/SIGTERM; children start clean
+    // in their own session.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults, empty;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTERM);
+    sigaddset(&defaults, SIGPIPE);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_SETSID
+    flags |= POSIX_SPAWN_SETSID;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, args[0], &actions, &attr, args.data(), envp.data());
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        std::cerr << "prism: failed to launch " << argv[0] << ": " << strerror(err) << "\n";
+        return -1;
+    }
+    return pid;
+}
+
+// Children launched by the WM, from spawn until they are reaped.
+struct Child {
+    std::vector<std::string> argv;
+    int px, py;
+    std::string display;
+    std::chrono::steady_clock::time_point started;
+    bool mapped;
+    bool restart;
+    int quick_exits;
+    std::string respawn_command;  // config line it came from, if any
+};
+
+static std::unordered_map<pid_t, Child> children;
+static int sigchld_fd = -1;
+
+// Respawns that die sooner than this count as failures; after
+// restart_limit of them in a row the command is left dead.
+static const std::chrono::seconds restart_min_uptime(5);
+static const int restart_limit = 5;
+
+static std::string describe(const std::vector<std::string>& argv) {
+    return argv.size() == 3 && argv[0] == "sh" && argv[1] == "-c" ? argv[2] : argv[0];
+}
+
+static pid_t spawn_tracked(const std::vector<std::string>& argv, int px, int py, const char* display_name,
+                           bool restart, int quick_exits) {
+    pid_t pid = spawn(argv, px, py, display_name);
+    if (pid > 0) {
+        children[pid] = { argv, px, py, display_name ? display_name : "",
+                          std::chrono::steady_clock::now(), false, restart, quick_exits, "" };
+    }
+    return pid;
+}
+
+// SIGCHLD is blocked and read from a signalfd in the event loop instead.
+// Must run before any thread starts so every thread inherits the mask.
+void init_supervisor() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd != -1) return;
+
+    // Without the fd nothing would ever reap; let the kernel do it instead.
+    // Exit logging and respawn are lost in this mode.
+    std::cerr << "prism: signalfd failed, children are not supervised\n";
+    sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+
+    struct sigaction sa = {};
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDWAIT;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, nullptr);
+}
+
+int child_fd() {
+    return sigchld_fd;
+}
+
+void supervise(pid_t pid, bool restart) {
+    auto it = children.find(pid);
+    if (it != children.end()) it->second.restart = restart;
+}
+
+// Called when child_fd() is readable: reaps every exited child, logs how it
+// ended and respawns the ones marked for restart.
+void reap_children() {
+    struct signalfd_siginfo info;
+    while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info)) {}
+
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto it = children.find(pid);
+        if (it == children.end()) continue;
+
+        Child child = std::move(it->second);
+        children.erase(it);
+
+        auto uptime = std::chrono::steady_clock::now() - child.started;
+        bool failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        if (failed || child.restart) {
+            std::cerr << "prism: " << describe(child.argv) << " (" << pid << ") ";
+            if (WIFSIGNALED(status)) std::cerr << "killed by signal " << WTERMSIG(status);
+            else std::cerr << "exited with " << WEXITSTATUS(status);
+            std::cerr << " after " << std::chrono::duration_cast<std::chrono::seconds>(uptime).count() << " s\n";
+        }
+
+        if (!child.restart) continue;
+
+        int quick_exits = uptime < restart_min_uptime ? child.quick_exits + 1 : 0;
+        if (quick_exits >= restart_limit) {
+            std::cerr << "prism: giving up on " << describe(child.argv) << "\n";
+            continue;
         }
-        execlp("sh", "sh", "-c", cmd, nullptr);
-        std::exit(1);
+        pid_t respawned = spawn_tracked(child.argv, child.px, child.py,
+                                        child.display.empty() ? nullptr : child.display.c_str(),
+                                        true, quick_exits);
+        if (respawned > 0) children[respawned].respawn_command = child.respawn_command;
     }
-}
\ No newline at end of file
+}
+
+// Brings the supervised children in line with the respawn= entries in
+// commands: new entries are started, and children whose entry went away
+// are left running but no longer restarted.
+void sync_respawn_commands(const std::vector<std::string>& commands, const char* display_name) {
+    std::vector<std::string> missing = commands;
+    for (auto& entry : children) {
+        Child& child = entry.second;
+        if (child.respawn_command.empty() || !child.restart) continue;
+
+        auto it = std::find(missing.begin(), missing.end(), child.respawn_command);
+        if (it != missing.end()) {
+            missing.erase(it);
+        } else {
+            supervise(entry.first, false);
+            child.respawn_command.clear();
+        }
+    }
+
+    for (const std::string& cmd : missing) {
+        pid_t pid = launch(cmd.c_str(), 0, 0, display_name);
+        if (pid <= 0) continue;
+        supervise(pid, true);
+        children[pid].respawn_command = cmd;
+    }
+}
+
+// Reports how long a launched program took to map its first window, for
+// windows whose _NET_WM_PID names one of our children.
+void note_child_window(pid_t pid) {
+    auto it = children.find(pid);
+    if (it == children.end() || it->second.mapped) return;
+
+    it->second.mapped = true;
+    auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - it->second.started);
+    std::cerr << "prism: " << describe(it->second.argv) << " mapped its first window "
+              << latency.count() << " ms after launch\n";
+}
+
+pid_t launch(const char* cmd, int px, int py, const char* display_name) {
+    std::vector<std::string> argv;
+    if (needs_shell(cmd)) {
+        argv = { "sh", "-c", cmd };
+    } else {
+        std::istringstream words(cmd);
+        std::string word;
+        while (words >> word) argv.push_back(word);
+        if (argv.empty()) return -1;
+    }
+    return spawn_tracked(argv, px, py, display_name, false, 0);
+}
+
+// Like launch, but execs argv directly without a shell in between.
+pid_t launch_argv(const std::vector<std::string>& argv, int px, int py, const char* display_name) {
+    if (argv.empty()) return -1;
+    return spawn_tracked(argv, px, py, display_name, false, 0);
+}
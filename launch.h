@@ -1,2 +1,15 @@
 #pragma once
-void launch(const char* cmd, int px, int py, const char* display_name);
\ No newline at end of file
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+pid_t launch(const char* cmd, int px, int py, const char* display_name);
+pid_t launch_argv(const std::vector<std::string>& argv, int px, int py, const char* display_name);
+
+void init_supervisor();
+int child_fd();
+void supervise(pid_t pid, bool restart);
+void reap_children();
+void note_child_window(pid_t pid);
+void sync_respawn_commands(const std::vector<std::string>& commands, const char* display_name);
@@ -7,13 +7,24 @@
 
 #include <security/pam_appl.h> 
 
+#include "monitor.h"
+#include "window.h"
+#include "launch.h"
+
 #include <ctime>
 #include <cstring>
 #include <iostream>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <pwd.h>
 #include <string>
 #include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
 #include <cctype>
 
 extern Display* display;
@@ -30,50 +41,126 @@ int screen;
 
 Pixmap back_buffer;
 
-const int refresh_interval = 0.1;
-
-int primary_x = 0, primary_y = 0, primary_width = 0, primary_height = 0;
-
-int virtual_width = 0;
-int virtual_height = 0;
+// lock_win covers the primary monitor and carries the UI; every other
+// monitor just gets a black window that the server paints by itself.
+int primary_width = 0, primary_height = 0;
+std::vector<Window> blank_windows;
 
 std::string input_password;
 
-static void handle_button_press(XButtonEvent* ev) {}
-static void handle_button_release(XButtonEvent* ev) {}
-static void handle_motion_notify(XMotionEvent* ev) {}
-
-std::string get_time_string() {
-    time_t now = time(nullptr);
+// Regions of back_buffer changed since the last copy to lock_win, and where
+// the clock was last drawn so it can be cleared if its layout changes.
+std::vector<XRectangle> lock_damage;
+XRectangle clock_rect = { 0, 0, 0, 0 };
+
+// Every glyph the clock can show, rasterized once per lock into one
+// fixed-width cell each of clock_atlas. A tick copies only the cells whose
+// character changed instead of laying out the string with Xft again.
+static const char clock_glyphs[] = "0123456789: AMP";
+Pixmap clock_atlas = None;
+int clock_advance = 0;
+int clock_height = 0;
+std::string clock_text;
+time_t clock_second = -1;
+
+// PAM runs on auth_thread so a slow module or pam_faildelay can't freeze
+// the lock screen; the result comes back through auth_event_fd.
+std::thread auth_thread;
+int auth_event_fd = -1;
+bool auth_in_flight = false;
+std::atomic<bool> auth_result(false);
+
+std::string get_time_string(time_t now) {
     struct tm* t = localtime(&now);
     char buf[64];
     strftime(buf, sizeof(buf), "%I:%M:%S %p", t);
     return buf;
 }
 
+void damage_lock(int x, int y, int width, int height) {
+    if (width <= 0 || height <= 0) return;
+    lock_damage.push_back({ (short)x, (short)y, (unsigned short)width, (unsigned short)height });
+}
+
 void clear_back_buffer() {
     XSetForeground(display, gc, BlackPixel(display, screen));
-    XFillRectangle(display, back_buffer, gc, 0, 0, virtual_width, virtual_height);
+    XFillRectangle(display, back_buffer, gc, 0, 0, primary_width, primary_height);
+    damage_lock(0, 0, primary_width, primary_height);
 }
 
 
-void draw_time() {
-    std::string time_str = get_time_string();
-    XGlyphInfo extents;
-    XftTextExtentsUtf8(display, font, (FcChar8*)time_str.c_str(), time_str.length(), &extents);
+void build_clock_atlas() {
+    const int count = sizeof(clock_glyphs) - 1;
 
-    int x = primary_x + (primary_width - extents.xOff) / 2;
-    int y = primary_y + (primary_height + font->ascent) / 2;
+    clock_advance = 0;
+    for (int i = 0; i < count; ++i) {
+        XGlyphInfo extents;
+        XftTextExtents8(display, font, (const FcChar8*)&clock_glyphs[i], 1, &extents);
+        clock_advance = std::max(clock_advance, (int)extents.xOff);
+    }
+    clock_height = font->ascent + font->descent;
+
+    clock_atlas = XCreatePixmap(display, lock_win, clock_advance * count, clock_height,
+                                DefaultDepth(display, screen));
+    XSetForeground(display, gc, BlackPixel(display, screen));
+    XFillRectangle(display, clock_atlas, gc, 0, 0, clock_advance * count, clock_height);
 
+    XftDraw* atlas_draw = XftDrawCreate(display, clock_atlas, visual, colormap);
+    for (int i = 0; i < count; ++i) {
+        XGlyphInfo extents;
+        XftTextExtents8(display, font, (const FcChar8*)&clock_glyphs[i], 1, &extents);
 
-    XftDrawStringUtf8(xft_draw, &xft_color, font, x, y, (FcChar8*)time_str.c_str(), time_str.length());
+        XRectangle cell = { (short)(i * clock_advance), 0, (unsigned short)clock_advance, (unsigned short)clock_height };
+        XftDrawSetClipRectangles(atlas_draw, 0, 0, &cell, 1);
+        XftDrawString8(atlas_draw, &xft_color, font, cell.x + (clock_advance - extents.xOff) / 2, font->ascent,
+                       (const FcChar8*)&clock_glyphs[i], 1);
+    }
+    XftDrawDestroy(atlas_draw);
+}
+
+void draw_time() {
+    time_t now = time(nullptr);
+    if (now == clock_second) return;
+    clock_second = now;
+
+    std::string time_str = get_time_string(now);
+    int width = clock_advance * time_str.size();
+    int x = (primary_width - width) / 2;
+    int y = (primary_height + font->ascent) / 2 - font->ascent;
+
+    // A different string length moves every cell; start over.
+    if (time_str.size() != clock_text.size()) {
+        if (clock_rect.width > 0) {
+            XSetForeground(display, gc, BlackPixel(display, screen));
+            XFillRectangle(display, back_buffer, gc, clock_rect.x, clock_rect.y, clock_rect.width, clock_rect.height);
+            damage_lock(clock_rect.x, clock_rect.y, clock_rect.width, clock_rect.height);
+        }
+        clock_text.assign(time_str.size(), '\0');
+    }
+    clock_rect = { (short)x, (short)y, (unsigned short)width, (unsigned short)clock_height };
+
+    for (size_t i = 0; i < time_str.size(); ++i) {
+        if (time_str[i] == clock_text[i]) continue;
+
+        int cell_x = x + i * clock_advance;
+        const char* glyph = strchr(clock_glyphs, time_str[i]);
+        if (glyph) {
+            XCopyArea(display, clock_atlas, back_buffer, gc, (glyph - clock_glyphs) * clock_advance, 0,
+                      clock_advance, clock_height, cell_x, y);
+        } else {
+            XSetForeground(display, gc, BlackPixel(display, screen));
+            XFillRectangle(display, back_buffer, gc, cell_x, y, clock_advance, clock_height);
+        }
+        damage_lock(cell_x, y, clock_advance, clock_height);
+    }
+    clock_text = time_str;
 }
 
 void draw_password_box() {
     int box_width = 400;
     int box_height = 50;
-    int box_x = primary_x + (primary_width - box_width) / 2;
-    int box_y = primary_y + (primary_height + font->ascent) / 2 + 60;
+    int box_x = (primary_width - box_width) / 2;
+    int box_y = (primary_height + font->ascent) / 2 + 60;
 
 
     XSetForeground(display, gc, BlackPixel(display, screen));
@@ -82,7 +169,7 @@ void draw_password_box() {
     XSetForeground(display, gc, WhitePixel(display, screen));
     XDrawRectangle(display, back_buffer, gc, box_x, box_y, box_width, box_height);
 
-    std::string masked(input_password.size(), '*');
+    std::string masked = auth_in_flight ? "verifying..." : std::string(input_password.size(), '*');
 
     XGlyphInfo extents;
     XftTextExtentsUtf8(display, font, (FcChar8*)masked.c_str(), masked.length(), &extents);
@@ -90,8 +177,76 @@ void draw_password_box() {
     int text_x = box_x + 10;
     int text_y = box_y + (box_height + font->ascent) / 2 - 5;
 
+    // Keep the asterisks inside the box so only the box is ever damaged.
+    XRectangle clip = { (short)(box_x + 1), (short)(box_y + 1),
+                        (unsigned short)(box_width - 1), (unsigned short)(box_height - 1) };
+    XftDrawSetClipRectangles(xft_draw, 0, 0, &clip, 1);
     XftDrawStringUtf8(xft_draw, &xft_color, font, text_x, text_y,
                       (FcChar8*)masked.c_str(), masked.length());
+    XftDrawSetClip(xft_draw, None);
+
+    damage_lock(box_x, box_y, box_width + 1, box_height + 1);
+}
+
+// Copies only the damaged parts of back_buffer to the window.
+void present_lock_damage() {
+    if (lock_damage.empty()) return;
+    for (const XRectangle& r : lock_damage) {
+        XCopyArea(display, back_buffer, lock_win, gc, r.x, r.y, r.width, r.height, r.x, r.y);
+    }
+    lock_damage.clear();
+    XFlush(display);
+}
+
+// A timerfd that ticks on every wall-clock second, so the clock flips in
+// step with the real time instead of drifting from when the lock started.
+static int create_clock_timer() {
+    int fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd == -1) return -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = 1;
+    spec.it_value.tv_sec = now.tv_sec + 1;
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool verify_password(const std::string& password);
+
+// Hands the typed password to a worker and shows the verifying state.
+// Keys are ignored until the answer arrives.
+void start_authentication() {
+    std::string password;
+    password.swap(input_password);
+    auth_in_flight = true;
+
+    int fd = auth_event_fd;
+    auth_thread = std::thread([password, fd]() mutable {
+        auth_result = verify_password(password);
+        std::fill(password.begin(), password.end(), '\0');
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+            std::cerr << "prism: failed to signal authentication result\n";
+        }
+    });
+}
+
+// Collects a finished authentication. Returns true if the screen should
+// unlock.
+bool finish_authentication() {
+    uint64_t count;
+    if (read(auth_event_fd, &count, sizeof(count)) != sizeof(count)) return false;
+    if (!auth_in_flight) return false;
+
+    auth_thread.join();
+    auth_in_flight = false;
+    return auth_result;
 }
 
 static int pam_conv_func(int num_msg, const struct pam_message** msg,
@@ -134,56 +289,51 @@ bool verify_password(const std::string& password) {
     return pam_err == PAM_SUCCESS;
 }
 
+// Newly managed windows are mapped on top; put the lock back over them.
+static void raise_lock_surfaces() {
+    for (Window blank : blank_windows) XRaiseWindow(display, blank);
+    XRaiseWindow(display, lock_win);
+}
+
+static Window create_lock_surface(int x, int y, int width, int height) {
+    Window win = XCreateSimpleWindow(display, root, x, y, width, height, 0,
+                                     BlackPixel(display, screen), BlackPixel(display, screen));
+
+    XSetWindowAttributes attrs;
+    attrs.override_redirect = True;
+    XChangeWindowAttributes(display, win, CWOverrideRedirect, &attrs);
+    return win;
+}
+
 void lock() {
     screen = DefaultScreen(display);
     root = RootWindow(display, screen);
     visual = DefaultVisual(display, screen);
     colormap = DefaultColormap(display, screen);
 
-    int width = 0, height = 0;
-
-    XRRScreenResources* res = XRRGetScreenResources(display, root);
-    RROutput primary = XRRGetOutputPrimary(display, root);
-
-    for (int i = 0; i < res->noutput; ++i) {
-        if (res->outputs[i] == primary) {
-            XRROutputInfo* output_info = XRRGetOutputInfo(display, res, primary);
-            if (output_info && output_info->crtc != 0) {
-                XRRCrtcInfo* crtc_info = XRRGetCrtcInfo(display, res, output_info->crtc);
-                primary_x = crtc_info->x;
-                primary_y = crtc_info->y;
-                primary_width = crtc_info->width;
-                primary_height = crtc_info->height;
-                XRRFreeCrtcInfo(crtc_info);
-            }
-            XRRFreeOutputInfo(output_info);
-        }
-
-        XRROutputInfo* info = XRRGetOutputInfo(display, res, res->outputs[i]);
-        if (info && info->crtc != 0) {
-            XRRCrtcInfo* crtc = XRRGetCrtcInfo(display, res, info->crtc);
-            int right = crtc->x + crtc->width;
-            int bottom = crtc->y + crtc->height;
-            width = std::max(width, right);
-            height = std::max(height, bottom);
-            virtual_width = width;
-            virtual_height = height;
-
-            XRRFreeCrtcInfo(crtc);
-        }
-        XRRFreeOutputInfo(info);
-        
+    std::vector<Monitor> monitors = get_monitors(display);
+    const Monitor* primary = nullptr;
+    for (const Monitor& m : monitors) {
+        if (m.primary) primary = &m;
     }
-    XRRFreeScreenResources(res);
-
-    lock_win = XCreateSimpleWindow(display, root, 0, 0, width, height, 0,
-                                BlackPixel(display, screen), BlackPixel(display, screen));
-
 
+    if (primary) {
+        primary_width = primary->width;
+        primary_height = primary->height;
+        lock_win = create_lock_surface(primary->x, primary->y, primary->width, primary->height);
+    } else {
+        primary_width = DisplayWidth(display, screen);
+        primary_height = DisplayHeight(display, screen);
+        lock_win = create_lock_surface(0, 0, primary_width, primary_height);
+    }
 
-    XSetWindowAttributes attrs;
-    attrs.override_redirect = True;
-    XChangeWindowAttributes(display, lock_win, CWOverrideRedirect, &attrs);
+    blank_windows.clear();
+    for (const Monitor& m : monitors) {
+        if (&m == primary) continue;
+        Window blank = create_lock_surface(m.x, m.y, m.width, m.height);
+        XMapRaised(display, blank);
+        blank_windows.push_back(blank);
+    }
 
     XMapRaised(display, lock_win);
     XSelectInput(display, lock_win, ExposureMask | KeyPressMask);
@@ -191,39 +341,102 @@ void lock() {
     gc = XCreateGC(display, lock_win, 0, nullptr);
     font = XftFontOpenName(display, screen, "monospace-36");
 
-    back_buffer = XCreatePixmap(display, lock_win, width, height, DefaultDepth(display, screen));
+    back_buffer = XCreatePixmap(display, lock_win, primary_width, primary_height, DefaultDepth(display, screen));
 
     xft_draw = XftDrawCreate(display, back_buffer, visual, colormap);
 
     XRenderColor render_color = { 0xffff, 0xffff, 0xffff, 0xffff };
     XftColorAllocValue(display, visual, colormap, &render_color, &xft_color);
 
+    clock_rect = { 0, 0, 0, 0 };
+    clock_text.clear();
+    clock_second = -1;
+    build_clock_atlas();
+
+    clear_back_buffer();
+    draw_time();
+    draw_password_box();
+    lock_damage.clear();
+
+    int timer_fd = create_clock_timer();
+    if (timer_fd == -1) std::cerr << "prism: lock clock timer unavailable\n";
+
+    auth_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (auth_event_fd == -1) {
+        std::cerr << "prism: lock cannot create auth eventfd\n";
+    }
+
+    // Sleep until the server sends something or the clock needs a new
+    // second; nothing is drawn in between.
+    bool unlocked = false;
     while (true) {
         while (XPending(display)) {
             XEvent ev;
             XNextEvent(display, &ev);
 
-            if (ev.type == Expose) {
-                clear_back_buffer();
-                draw_time();
-                draw_password_box();
+            // Keep hotplugs seen while locked so the WM applies them after.
+            if (handle_monitor_event(&ev)) continue;
+
+            // Windows keep coming and going behind the lock; the registry,
+            // geometry and title caches have to follow them. Anything that
+            // can restack a client raises the lock back over it.
+            switch (ev.type) {
+                case MapRequest:
+                    handle_map_request(&ev.xmaprequest);
+                    raise_lock_surfaces();
+                    continue;
+                case DestroyNotify:
+                    handle_destroy_notify(&ev.xdestroywindow);
+                    continue;
+                case ConfigureNotify:
+                    handle_configure_notify(&ev.xconfigure);
+                    continue;
+                case ConfigureRequest:
+                    handle_configure_request(&ev.xconfigurerequest);
+                    raise_lock_surfaces();
+                    continue;
+                case PropertyNotify:
+                    handle_property_notify(&ev.xproperty);
+                    continue;
+                case ClientMessage:
+                    handle_client_message(&ev.xclient);
+                    raise_lock_surfaces();
+                    continue;
+                case MapNotify:
+                    handle_map_notify(&ev.xmap);
+                    continue;
+                case UnmapNotify:
+                    handle_unmap_notify(&ev.xunmap);
+                    continue;
+                case FocusIn:
+                    handle_focus_in(&ev.xfocus);
+                    continue;
+                case FocusOut:
+                    handle_focus_out(&ev.xfocus);
+                    continue;
+            }
 
-                XCopyArea(display, back_buffer, lock_win, gc, 0, 0, virtual_width, virtual_height, 0, 0);
-                XFlush(display);
+            if (ev.type == Expose) {
+                // back_buffer always holds the full frame; just recopy.
+                damage_lock(ev.xexpose.x, ev.xexpose.y, ev.xexpose.width, ev.xexpose.height);
+                if (ev.xexpose.count == 0) present_lock_damage();
             } else if (ev.type == KeyPress) {
                 char buf[32];
                 KeySym keysym;
                 int len = XLookupString(&ev.xkey, buf, sizeof(buf) - 1, &keysym, nullptr);
                 buf[len] = '\0';
 
-                if (keysym == XK_Return) {
-                    if (verify_password(input_password)) {
+                if (auth_in_flight) {
+                    continue;
+                } else if (keysym == XK_Return) {
+                    if (auth_event_fd != -1) {
+                        start_authentication();
+                    } else if (verify_password(input_password)) {
                         input_password.clear();
-                        XFreePixmap(display, back_buffer);
-                        XDestroyWindow(display, lock_win);
-                        return;
+                        unlocked = true;
+                        break;
                     } else {
-                        input_password.clear(); 
+                        input_password.clear();
                     }
                 } else if (keysym == XK_BackSpace) {
                     if (!input_password.empty())
@@ -232,20 +445,50 @@ void lock() {
                     input_password += buf[0];
                 }
 
-                clear_back_buffer();
-                draw_time();
                 draw_password_box();
-
-                XCopyArea(display, back_buffer, lock_win, gc, 0, 0, width, height, 0, 0);
-                XFlush(display);
+                present_lock_damage();
             }
         }
 
-        clear_back_buffer();
-        draw_time();
-        draw_password_box();
-        XCopyArea(display, back_buffer, lock_win, gc, 0, 0, width, height, 0, 0);
-        XFlush(display);
-        usleep((int)(refresh_interval * 1e6));
+        if (unlocked) break;
+
+        // Bars and agents that die while locked are reaped and respawned
+        // here rather than after unlock.
+        struct pollfd fds[4] = {
+            { ConnectionNumber(display), POLLIN, 0 },
+            { timer_fd, POLLIN, 0 },
+            { auth_event_fd, POLLIN, 0 },
+            { child_fd(), POLLIN, 0 },
+        };
+        if (poll(fds, 4, timer_fd == -1 ? 1000 : -1) < 0) continue;
+
+        if (fds[3].revents & POLLIN) reap_children();
+
+        if (fds[2].revents & POLLIN) {
+            if (finish_authentication()) break;
+            // Wrong password: the field was already emptied when it was sent.
+            draw_password_box();
+            present_lock_damage();
+        }
+
+        bool tick = timer_fd == -1;
+        if (timer_fd != -1 && (fds[1].revents & POLLIN)) {
+            uint64_t expirations;
+            tick = read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+        }
+        if (tick) {
+            draw_time();
+            present_lock_damage();
+        }
     }
+
+    if (timer_fd != -1) close(timer_fd);
+    if (auth_event_fd != -1) close(auth_event_fd);
+    auth_event_fd = -1;
+    XFreePixmap(display, back_buffer);
+    XFreePixmap(display, clock_atlas);
+    clock_atlas = None;
+    XDestroyWindow(display, lock_win);
+    for (Window blank : blank_windows) XDestroyWindow(display, blank);
+    blank_windows.clear();
 }
@@ -1,137 +1,262 @@
-#include "monitor.h"
 #include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "client.h"
+#include "config.h"
+#include "monitor.h"
+#include "paper.h"
+#include "window.h"
 
+// Monitor layout as last reported by XRandR. Rebuilt lazily on the first
+// query after a screen, CRTC or output change event marks it stale.
+static std::vector<Monitor> monitors;
+static bool monitors_dirty = true;
+static int randr_event_base = -1;
 
+// Layout windows and the wallpaper were last arranged for, and when the
+// first change event of a not yet applied hotplug arrived.
+static std::vector<Monitor> applied_monitors;
+static bool layout_pending = false;
+static std::chrono::steady_clock::time_point layout_change_start;
 
+static void rebuild_monitors(Display* dpy) {
+    monitors_dirty = false;
+    monitors.clear();
 
-bool get_monitor_geometry(Display* dpy, Window win, int* x, int* y, int* w, int* h) {
     Window root = DefaultRootWindow(dpy);
-    XWindowAttributes win_attr;
-    if (!XGetWindowAttributes(dpy, win, &win_attr)) return false;
     XRRScreenResources* res = XRRGetScreenResourcesCurrent(dpy, root);
-    if (!res) return false;
-    XRRCrtcInfo* crtc = nullptr;
-    int cx = win_attr.x + win_attr.width / 2;
-    int cy = win_attr.y + win_attr.height / 2;
+    if (!res) return;
+
+    RROutput primary_output = XRRGetOutputPrimary(dpy, root);
+
     for (int i = 0; i < res->ncrtc; ++i) {
-        crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[i]);
+        XRRCrtcInfo* crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[i]);
         if (!crtc) continue;
-        if (cx >= crtc->x && cx < crtc->x + crtc->width &&
-            cy >= crtc->y && cy < crtc->y + crtc->height) {
-            *x = crtc->x; *y = crtc->y; *w = crtc->width; *h = crtc->height;
+        if (crtc->mode == None || crtc->width == 0 || crtc->height == 0) {
             XRRFreeCrtcInfo(crtc);
-            XRRFreeScreenResources(res);
-            return true;
+            continue;
+        }
+
+        Monitor m = {};
+        m.x = crtc->x;
+        m.y = crtc->y;
+        m.width = crtc->width;
+        m.height = crtc->height;
+
+        for (int j = 0; j < crtc->noutput; ++j) {
+            if (crtc->outputs[j] == primary_output) m.primary = true;
         }
+
+        for (int k = 0; k < res->nmode; ++k) {
+            const XRRModeInfo& mode = res->modes[k];
+            if (mode.id == crtc->mode && mode.hTotal && mode.vTotal) {
+                m.refresh = (double)mode.dotClock / ((double)mode.hTotal * mode.vTotal);
+                break;
+            }
+        }
+
+        monitors.push_back(m);
         XRRFreeCrtcInfo(crtc);
     }
+
     XRRFreeScreenResources(res);
+
+    bool has_primary = std::any_of(monitors.begin(), monitors.end(),
+                                   [](const Monitor& m) { return m.primary; });
+    if (!has_primary && !monitors.empty()) monitors[0].primary = true;
+}
+
+void init_monitors(Display* dpy) {
+    int error_base;
+    if (XRRQueryExtension(dpy, &randr_event_base, &error_base)) {
+        XRRSelectInput(dpy, DefaultRootWindow(dpy),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+    } else {
+        randr_event_base = -1;
+    }
+    rebuild_monitors(dpy);
+    applied_monitors = monitors;
+}
+
+static void mark_layout_changed() {
+    monitors_dirty = true;
+    if (!layout_pending) {
+        layout_pending = true;
+        layout_change_start = std::chrono::steady_clock::now();
+    }
+}
+
+bool handle_monitor_event(XEvent* ev) {
+    if (randr_event_base < 0) return false;
+
+    if (ev->type == randr_event_base + RRScreenChangeNotify) {
+        XRRUpdateConfiguration(ev);
+        mark_layout_changed();
+        return true;
+    }
+    if (ev->type == randr_event_base + RRNotify) {
+        mark_layout_changed();
+        return true;
+    }
     return false;
 }
 
-bool get_primary_monitor_geometry(Display* dpy, int* x, int* y, int* w, int* h) {
-    Window root = DefaultRootWindow(dpy);
-    XRRScreenResources* res = XRRGetScreenResourcesCurrent(dpy, root);
-    if (!res) return false;
+bool monitor_layout_pending() {
+    return layout_pending;
+}
 
-    RROutput primary_output = XRRGetOutputPrimary(dpy, root);
-    if (primary_output == None) {
-        if (res->ncrtc < 1) {
-            XRRFreeScreenResources(res);
-            return false;
-        }
-        XRRCrtcInfo* crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[0]);
-        if (!crtc) {
-            XRRFreeScreenResources(res);
+static bool same_layout(const std::vector<Monitor>& a, const std::vector<Monitor>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].x != b[i].x || a[i].y != b[i].y ||
+            a[i].width != b[i].width || a[i].height != b[i].height) {
             return false;
         }
-        *x = crtc->x;
-        *y = crtc->y;
-        *w = crtc->width;
-        *h = crtc->height;
-        XRRFreeCrtcInfo(crtc);
-        XRRFreeScreenResources(res);
-        return true;
     }
+    return true;
+}
 
-    XRRCrtcInfo* crtc = nullptr;
-    for (int i = 0; i < res->ncrtc; ++i) {
-        XRRCrtcInfo* info = XRRGetCrtcInfo(dpy, res, res->crtcs[i]);
-        if (!info) continue;
-        for (int j = 0; j < info->noutput; ++j) {
-            if (info->outputs[j] == primary_output) {
-                crtc = info;
-                break;
-            }
-        }
-        if (crtc) {
-            for (int k = i + 1; k < res->ncrtc; ++k) {
-                XRRCrtcInfo* temp = XRRGetCrtcInfo(dpy, res, res->crtcs[k]);
-                if (temp) XRRFreeCrtcInfo(temp);
+static const Monitor* best_overlap(const std::vector<Monitor>& list, int x, int y, int w, int h) {
+    const Monitor* best = nullptr;
+    long best_area = 0;
+
+    for (const Monitor& m : list) {
+        int inter_x = std::max(x, m.x);
+        int inter_y = std::max(y, m.y);
+        int inter_w = std::min(x + w, m.x + m.width) - inter_x;
+        int inter_h = std::min(y + h, m.y + m.height) - inter_y;
+
+        if (inter_w > 0 && inter_h > 0) {
+            long area = (long)inter_w * inter_h;
+            if (area > best_area) {
+                best_area = area;
+                best = &m;
             }
-            break;
-        } else {
-            XRRFreeCrtcInfo(info);
         }
     }
+    return best;
+}
 
-    if (!crtc) {
-        crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[0]);
-        if (!crtc) {
-            XRRFreeScreenResources(res);
-            return false;
+static const Monitor* nearest_monitor(const std::vector<Monitor>& list, int x, int y) {
+    const Monitor* best = nullptr;
+    long best_dist = 0;
+
+    for (const Monitor& m : list) {
+        long dx = std::max({m.x - x, 0, x - (m.x + m.width - 1)});
+        long dy = std::max({m.y - y, 0, y - (m.y + m.height - 1)});
+        long dist = dx * dx + dy * dy;
+        if (!best || dist < best_dist) {
+            best = &m;
+            best_dist = dist;
         }
     }
+    return best;
+}
 
-    *x = crtc->x;
-    *y = crtc->y;
-    *w = crtc->width;
-    *h = crtc->height;
+// Called once the event queue is drained after an XRandR change. Moves
+// windows left on vanished monitors onto the nearest remaining one and
+// re-renders the wallpaper for the new layout.
+bool apply_monitor_layout(Display* dpy) {
+    if (!layout_pending) return false;
+    layout_pending = false;
 
-    XRRFreeCrtcInfo(crtc);
-    XRRFreeScreenResources(res);
-    return true;
-}
+    const std::vector<Monitor>& current = get_monitors(dpy);
+    if (same_layout(current, applied_monitors) || current.empty()) return false;
 
-bool get_monitor_geometry_for_window(Display* dpy, Window win, int* x, int* y, int* w, int* h) {
-    XWindowAttributes attr;
-    if (!XGetWindowAttributes(dpy, win, &attr)) return false;
+    int moved = 0;
+    for (Client& client : all_clients()) {
+        Client* c = &client;
+        if (best_overlap(current, c->x, c->y, c->width, c->height)) continue;
 
-    Window root = DefaultRootWindow(dpy);
-    XRRScreenResources* res = XRRGetScreenResourcesCurrent(dpy, root);
-    if (!res) return false;
+        const Monitor* old_mon = best_overlap(applied_monitors, c->x, c->y, c->width, c->height);
+        const Monitor* new_mon = nearest_monitor(current, c->x + c->width / 2, c->y + c->height / 2);
+        if (!new_mon) continue;
 
-    int best_area = 0;
-    bool found = false;
+        int width = std::min(c->width, new_mon->width);
+        int height = std::min(c->height, new_mon->height);
+        int offset_x = old_mon ? c->x - old_mon->x : (new_mon->width - width) / 2;
+        int offset_y = old_mon ? c->y - old_mon->y : (new_mon->height - height) / 2;
+        offset_x = std::max(0, std::min(offset_x, new_mon->width - width));
+        offset_y = std::max(0, std::min(offset_y, new_mon->height - height));
 
-    for (int i = 0; i < res->ncrtc; ++i) {
-        XRRCrtcInfo* crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[i]);
-        if (crtc->mode == None) {
-            XRRFreeCrtcInfo(crtc);
-            continue;
-        }
+        move_resize_client(c, new_mon->x + offset_x, new_mon->y + offset_y, width, height);
+        ++moved;
+    }
 
-        int inter_x = std::max(attr.x, static_cast<int>(crtc->x));
-        int inter_y = std::max(attr.y, static_cast<int>(crtc->y));
-        int inter_w = std::min(attr.x + static_cast<int>(attr.width), static_cast<int>(crtc->x + crtc->width)) - inter_x;
-        int inter_h = std::min(attr.y + static_cast<int>(attr.height), static_cast<int>(crtc->y + crtc->height)) - inter_y;
+    applied_monitors = current;
 
+    XSync(dpy, False);
 
-        if (inter_w > 0 && inter_h > 0) {
-            int area = inter_w * inter_h;
-            if (area > best_area) {
-                best_area = area;
-                *x = crtc->x;
-                *y = crtc->y;
-                *w = crtc->width;
-                *h = crtc->height;
-                found = true;
-            }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - layout_change_start).count();
+    if (!wallpaper_path.empty()) {
+        // The total is reported once the new wallpaper is installed.
+        time_layout_wallpaper(layout_change_start, elapsed, moved);
+        setpaper(wallpaper_path);
+    } else {
+        std::cerr << "prism: layout stable " << elapsed << " ms after monitor change ("
+                  << moved << " windows moved)\n";
+    }
+    return true;
+}
+
+const std::vector<Monitor>& get_monitors(Display* dpy) {
+    if (monitors_dirty) rebuild_monitors(dpy);
+    return monitors;
+}
+
+const Monitor* monitor_at(Display* dpy, int x, int y) {
+    for (const Monitor& m : get_monitors(dpy)) {
+        if (x >= m.x && x < m.x + m.width &&
+            y >= m.y && y < m.y + m.height) {
+            return &m;
         }
+    }
+    return nullptr;
+}
 
-        XRRFreeCrtcInfo(crtc);
+const Monitor* monitor_for_rect(Display* dpy, int x, int y, int w, int h) {
+    return best_overlap(get_monitors(dpy), x, y, w, h);
+}
+
+static bool copy_geometry(const Monitor* m, int* x, int* y, int* w, int* h) {
+    if (!m) return false;
+    *x = m->x; *y = m->y; *w = m->width; *h = m->height;
+    return true;
+}
+
+bool get_monitor_geometry(Display* dpy, Window win, int* x, int* y, int* w, int* h) {
+    XWindowAttributes win_attr;
+    if (!XGetWindowAttributes(dpy, win, &win_attr)) return false;
+    int cx = win_attr.x + win_attr.width / 2;
+    int cy = win_attr.y + win_attr.height / 2;
+    return copy_geometry(monitor_at(dpy, cx, cy), x, y, w, h);
+}
+
+bool get_primary_monitor_geometry(Display* dpy, int* x, int* y, int* w, int* h) {
+    for (const Monitor& m : get_monitors(dpy)) {
+        if (m.primary) return copy_geometry(&m, x, y, w, h);
     }
+    return false;
+}
 
-    XRRFreeScreenResources(res);
-    return found;
+bool get_monitor_geometry_for_window(Display* dpy, Window win, int* x, int* y, int* w, int* h) {
+    XWindowAttributes attr;
+    if (!XGetWindowAttributes(dpy, win, &attr)) return false;
+    return get_monitor_geometry_for_rect(dpy, attr.x, attr.y, attr.width, attr.height, x, y, w, h);
+}
+
+bool get_monitor_geometry_for_rect(Display* dpy, int rx, int ry, int rw, int rh, int* x, int* y, int* w, int* h) {
+    return copy_geometry(monitor_for_rect(dpy, rx, ry, rw, rh), x, y, w, h);
+}
+
+double get_primary_refresh_rate(Display* dpy) {
+    for (const Monitor& m : get_monitors(dpy)) {
+        if (m.primary) return m.refresh;
+    }
+    return 0;
 }
@@ -1,6 +1,25 @@
 #pragma once
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrandr.h>
+#include <vector>
+
+struct Monitor {
+    int x, y;
+    int width, height;
+    double refresh;
+    bool primary;
+};
+
+void init_monitors(Display* dpy);
+bool handle_monitor_event(XEvent* ev);
+bool monitor_layout_pending();
+bool apply_monitor_layout(Display* dpy);
+const std::vector<Monitor>& get_monitors(Display* dpy);
+const Monitor* monitor_at(Display* dpy, int x, int y);
+const Monitor* monitor_for_rect(Display* dpy, int x, int y, int w, int h);
+
 bool get_monitor_geometry(Display* dpy, Window win, int* x, int* y, int* w, int* h);
 bool get_primary_monitor_geometry(Display* dpy, int* x, int* y, int* w, int* h);
-bool get_monitor_geometry_for_window(Display* dpy, Window win, int* x, int* y, int* w, int* h);
\ No newline at end of file
+bool get_monitor_geometry_for_window(Display* dpy, Window win, int* x, int* y, int* w, int* h);
+bool get_monitor_geometry_for_rect(Display* dpy, int rx, int ry, int rw, int rh, int* x, int* y, int* w, int* h);
+double get_primary_refresh_rate(Display* dpy);
@@ -1,9 +1,26 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
 #include <X11/extensions/Xrandr.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <cstring>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <iostream>
 #include <vector>
 #include <cstdlib>
+#include <cmath>
 #include <malloc.h>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -11,143 +28,631 @@
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "stb_image_resize.h"
 
-struct Monitor {
-    int x, y;
-    unsigned int width, height;
+#include "monitor.h"
+#include "window.h"
+#include "paper.h"
+#include "pixel.h"
+
+#include <cstdint>
+
+extern Display* display;
+
+// Background pixmap currently installed on the root window.
+static Pixmap root_pixmap = None;
+
+static bool is_direct_xrgb(const XImage* img) {
+    return img->bits_per_pixel == 32 &&
+           img->red_mask == 0xff0000 && img->green_mask == 0xff00 && img->blue_mask == 0xff;
+}
+
+// Converts RGBA pixels into the 32-bit xRGB words of img, swapping bytes
+// when the server's byte order differs from ours. src and dst may alias.
+static void convert_to_image_order(const XImage* img, const unsigned char* src, uint32_t* dst, size_t count) {
+    static const ConvertRow convert_row = pick_row_converter();
+    const int host_order = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ? LSBFirst : MSBFirst;
+
+    convert_row(src, dst, count);
+    if (img->byte_order != host_order) {
+        for (size_t i = 0; i < count; ++i) dst[i] = __builtin_bswap32(dst[i]);
+    }
+}
+
+// Writes an RGBA block into img at (dst_x, dst_y). 32-bit xRGB visuals get
+// whole rows converted straight into the image buffer; anything else goes
+// through XPutPixel.
+static void blit_rgba(XImage* img, const unsigned char* src, int dst_x, int dst_y, int width, int height) {
+    bool direct = is_direct_xrgb(img);
+
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* src_row = src + (size_t)y * width * 4;
+
+        if (!direct) {
+            for (int x = 0; x < width; ++x) {
+                const unsigned char* p = src_row + x * 4;
+                XPutPixel(img, dst_x + x, dst_y + y, ((unsigned long)p[0] << 16) | (p[1] << 8) | p[2]);
+            }
+            continue;
+        }
+
+        uint32_t* dst_row = (uint32_t*)(img->data + (size_t)(dst_y + y) * img->bytes_per_line) + dst_x;
+        convert_to_image_order(img, src_row, dst_row, width);
+    }
+}
+
+static bool shm_attach_failed = false;
+
+static int shm_error_handler(Display*, XErrorEvent*) {
+    shm_attach_failed = true;
+    return 0;
+}
+
+// Creates an XImage backed by a MIT-SHM segment. Returns nullptr when the
+// extension is missing or the server cannot attach the segment, which is
+// the case for remote displays.
+static XImage* create_shm_image(Display* display, int screen, unsigned int width, unsigned int height,
+                                XShmSegmentInfo* shminfo) {
+    if (!XShmQueryExtension(display)) return nullptr;
+
+    XImage* img = XShmCreateImage(display, DefaultVisual(display, screen), DefaultDepth(display, screen),
+                                  ZPixmap, nullptr, shminfo, width, height);
+    if (!img) return nullptr;
+
+    shminfo->shmid = shmget(IPC_PRIVATE, (size_t)img->bytes_per_line * img->height, IPC_CREAT | 0600);
+    if (shminfo->shmid < 0) {
+        XDestroyImage(img);
+        return nullptr;
+    }
+
+    shminfo->shmaddr = img->data = (char*)shmat(shminfo->shmid, nullptr, 0);
+    shminfo->readOnly = True;
+    if (shminfo->shmaddr == (char*)-1) {
+        shmctl(shminfo->shmid, IPC_RMID, nullptr);
+        img->data = nullptr;
+        XDestroyImage(img);
+        return nullptr;
+    }
+
+    XSync(display, False);
+    shm_attach_failed = false;
+    XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+    XShmAttach(display, shminfo);
+    XSync(display, False);
+    XSetErrorHandler(old_handler);
+
+    // The segment goes away once both sides have detached.
+    shmctl(shminfo->shmid, IPC_RMID, nullptr);
+
+    if (shm_attach_failed) {
+        shmdt(shminfo->shmaddr);
+        img->data = nullptr;
+        XDestroyImage(img);
+        return nullptr;
+    }
+    return img;
+}
+
+static void destroy_image(Display* display, XImage* img, XShmSegmentInfo* shminfo, bool shm) {
+    if (shm) {
+        XShmDetach(display, shminfo);
+        XSync(display, False);
+        shmdt(shminfo->shmaddr);
+    } else {
+        free(img->data);
+    }
+    img->data = nullptr;
+    XDestroyImage(img);
+}
+
+// The finished root image is cached on disk as a page-aligned header
+// followed by the raw XImage rows, so a warm start is a single copy out of
+// an mmap instead of a PNG decode plus one resize per monitor.
+struct WallpaperCacheHeader {
+    char magic[8];
+    uint32_t key_length;
+    uint32_t data_offset;
+    uint64_t data_size;
 };
 
-void setpaper(const std::string& imagePath) {
-    int img_w, img_h, channels;
-    unsigned char* data = stbi_load(imagePath.c_str(), &img_w, &img_h, &channels, 4);
-    if (!data) {
-        std::cerr << "Failed to load image: " << imagePath << "\n";
-        return;
+static const char wallpaper_cache_magic[8] = { 'P', 'R', 'I', 'S', 'M', 'W', 'P', '1' };
+static const size_t wallpaper_cache_align = 4096;
+
+// Empty when there is nowhere to put the cache, which turns it off.
+static std::string get_wallpaper_cache_path() {
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    std::string dir;
+    if (cache_home && *cache_home) {
+        dir = cache_home;
+    } else {
+        const char* home = getenv("HOME");
+        if (!home) {
+            struct passwd* pw = getpwuid(getuid());
+            if (!pw || !pw->pw_dir) return "";
+            home = pw->pw_dir;
+        }
+        dir = std::string(home) + "/.cache";
     }
+    mkdir(dir.c_str(), 0755);
+    dir += "/prism";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/wallpaper";
+}
 
-    Display* display = XOpenDisplay(NULL);
-    if (!display) {
-        std::cerr << "Cannot open X display\n";
-        stbi_image_free(data);
-        return;
+// Everything the finished image depends on: the source file, the monitor
+// layout and the pixel format of the XImage.
+static std::string wallpaper_cache_key(const std::string& image_path, const struct stat& st,
+                                       const std::vector<Monitor>& monitors, const XImage* img,
+                                       WallpaperMode mode, bool span) {
+    std::ostringstream key;
+    key << image_path << '\n'
+        << mode << ' ' << span << '\n'
+        << st.st_size << ' ' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << '\n'
+        << img->width << 'x' << img->height << ' ' << img->bytes_per_line << ' '
+        << img->bits_per_pixel << ' ' << img->byte_order << ' '
+        << img->red_mask << ' ' << img->green_mask << ' ' << img->blue_mask << '\n';
+    for (const Monitor& m : monitors) {
+        key << m.x << ',' << m.y << ' ' << m.width << 'x' << m.height << '\n';
     }
+    return key.str();
+}
 
-    Window root = DefaultRootWindow(display);
-    XRRScreenResources* screenRes = XRRGetScreenResources(display, root);
-    if (!screenRes) {
-        std::cerr << "Failed to get screen resources\n";
-        stbi_image_free(data);
-        XCloseDisplay(display);
-        return;
+static bool load_cached_wallpaper(const std::string& cache_path, const std::string& key, XImage* img) {
+    if (cache_path.empty()) return false;
+    int fd = open(cache_path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat st;
+    size_t data_size = (size_t)img->bytes_per_line * img->height;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(WallpaperCacheHeader)) {
+        close(fd);
+        return false;
     }
 
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const WallpaperCacheHeader* header = (const WallpaperCacheHeader*)map;
+    const char* base = (const char*)map;
+    bool hit = memcmp(header->magic, wallpaper_cache_magic, sizeof(header->magic)) == 0 &&
+               header->key_length == key.size() &&
+               sizeof(WallpaperCacheHeader) + key.size() <= header->data_offset &&
+               header->data_size == data_size &&
+               header->data_offset + data_size <= (size_t)st.st_size &&
+               memcmp(base + sizeof(WallpaperCacheHeader), key.data(), key.size()) == 0;
+
+    if (hit) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        memcpy(img->data, base + header->data_offset, data_size);
+    }
+
+    munmap(map, st.st_size);
+    return hit;
+}
+
+static void store_cached_wallpaper(const std::string& cache_path, const std::string& key, const XImage* img) {
+    if (cache_path.empty()) return;
+    WallpaperCacheHeader header = {};
+    memcpy(header.magic, wallpaper_cache_magic, sizeof(header.magic));
+    header.key_length = key.size();
+    header.data_offset = (sizeof(header) + key.size() + wallpaper_cache_align - 1) & ~(wallpaper_cache_align - 1);
+    header.data_size = (uint64_t)img->bytes_per_line * img->height;
+
+    std::string tmp_path = cache_path + ".tmp";
+    FILE* out = fopen(tmp_path.c_str(), "wb");
+    if (!out) return;
+
+    std::vector<char> padding(header.data_offset - sizeof(header) - key.size(), 0);
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(key.data(), 1, key.size(), out) == key.size() &&
+              fwrite(padding.data(), 1, padding.size(), out) == padding.size() &&
+              fwrite(img->data, 1, header.data_size, out) == header.data_size;
+    ok = fclose(out) == 0 && ok;
+
+    if (ok) {
+        rename(tmp_path.c_str(), cache_path.c_str());
+    } else {
+        unlink(tmp_path.c_str());
+    }
+}
+
+// One wallpaper render in flight. The X thread owns the XImage and does
+// every Xlib call; the worker only fills img->data.
+struct WallpaperJob {
+    std::string path;
     std::vector<Monitor> monitors;
-    unsigned int total_width = 0;
-    unsigned int total_height = 0;
+    unsigned int width, height;
+    XImage* img;
+    XShmSegmentInfo shminfo;
+    bool shm;
+    WallpaperMode mode;
+    bool span;
+    std::string cache_path;
+    std::string cache_key;
+    bool ok;
+    std::thread worker;
+};
 
-    for (int i = 0; i < screenRes->ncrtc; ++i) {
-        XRRCrtcInfo* crtcInfo = XRRGetCrtcInfo(display, screenRes, screenRes->crtcs[i]);
-        if (!crtcInfo || crtcInfo->width == 0 || crtcInfo->height == 0) {
-            if (crtcInfo) XRRFreeCrtcInfo(crtcInfo);
-            continue;
+static WallpaperJob* wallpaper_job = nullptr;
+static std::string queued_wallpaper;
+static int wallpaper_event_fd = -1;
+
+// Monitor change waiting for its wallpaper to be installed.
+static bool layout_timed = false;
+static std::chrono::steady_clock::time_point layout_start;
+static long layout_rehome_ms = 0;
+static int layout_moved = 0;
+
+void time_layout_wallpaper(std::chrono::steady_clock::time_point start, long rehome_ms, int moved) {
+    // A second change before the first one's wallpaper landed is timed
+    // from the first.
+    if (!layout_timed) layout_start = start;
+    layout_timed = true;
+    layout_rehome_ms = rehome_ms;
+    layout_moved = moved;
+}
+
+static void report_layout_latency() {
+    if (!layout_timed) return;
+    layout_timed = false;
+    XSync(display, False);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - layout_start).count();
+    std::cerr << "prism: layout stable " << elapsed << " ms after monitor change ("
+              << layout_rehome_ms << " ms to re-home " << layout_moved << " windows)\n";
+}
+
+int wallpaper_fd() {
+    if (wallpaper_event_fd == -1) {
+        wallpaper_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+    return wallpaper_event_fd;
+}
+
+// Where one copy of the source lands in the root image: the destination
+// rectangle, the source coordinate of its top-left pixel and the scale
+// from source to destination pixels.
+struct Placement {
+    int dst_x, dst_y, dst_w, dst_h;
+    double src_x, src_y;
+    double scale_x, scale_y;
+    bool tile;
+};
+
+static Placement place_wallpaper(WallpaperMode mode, int rx, int ry, int rw, int rh, int img_w, int img_h) {
+    Placement p = { rx, ry, rw, rh, 0.0, 0.0, 1.0, 1.0, false };
+
+    switch (mode) {
+        case WALLPAPER_STRETCH:
+            p.scale_x = (double)rw / img_w;
+            p.scale_y = (double)rh / img_h;
+            break;
+        case WALLPAPER_FILL: {
+            double scale = std::max((double)rw / img_w, (double)rh / img_h);
+            p.scale_x = p.scale_y = scale;
+            p.src_x = (img_w - rw / scale) / 2;
+            p.src_y = (img_h - rh / scale) / 2;
+            break;
         }
-        
-        monitors.push_back({
-            static_cast<int>(crtcInfo->x),
-            static_cast<int>(crtcInfo->y),
-            crtcInfo->width,
-            crtcInfo->height
-        });
-        
-        total_width = std::max(total_width, static_cast<unsigned int>(crtcInfo->x) + crtcInfo->width);
-        total_height = std::max(total_height, static_cast<unsigned int>(crtcInfo->y) + crtcInfo->height);
-        
-        XRRFreeCrtcInfo(crtcInfo);
-    }
-
-    XRRFreeScreenResources(screenRes);
-
-    unsigned char* final_img = (unsigned char*)calloc(total_width * total_height * 4, 1);
-    if (!final_img) {
-        std::cerr << "Memory allocation failed\n";
-        stbi_image_free(data);
-        XCloseDisplay(display);
-        return;
+        case WALLPAPER_FIT: {
+            double scale = std::min((double)rw / img_w, (double)rh / img_h);
+            p.dst_w = std::max(1, (int)std::lround(img_w * scale));
+            p.dst_h = std::max(1, (int)std::lround(img_h * scale));
+            p.dst_x = rx + (rw - p.dst_w) / 2;
+            p.dst_y = ry + (rh - p.dst_h) / 2;
+            p.scale_x = (double)p.dst_w / img_w;
+            p.scale_y = (double)p.dst_h / img_h;
+            break;
+        }
+        case WALLPAPER_CENTER:
+            p.dst_w = std::min(rw, img_w);
+            p.dst_h = std::min(rh, img_h);
+            p.dst_x = rx + (rw - p.dst_w) / 2;
+            p.dst_y = ry + (rh - p.dst_h) / 2;
+            p.src_x = (img_w - p.dst_w) / 2;
+            p.src_y = (img_h - p.dst_h) / 2;
+            break;
+        case WALLPAPER_TILE:
+            p.tile = true;
+            break;
     }
+    return p;
+}
 
-    for (const Monitor& m : monitors) {
-        unsigned char* resized = (unsigned char*)malloc(m.width * m.height * 4);
-        if (!resized) {
-            std::cerr << "Memory allocation failed for monitor " << m.width << "x" << m.height << "\n";
+// True when scale shrinks by a whole number of source pixels per
+// destination pixel (1 meaning a straight copy).
+static bool integer_downscale(double scale, int* factor) {
+    double inverse = 1.0 / scale;
+    long rounded = std::lround(inverse);
+    if (rounded < 1 || std::fabs(inverse - rounded) > 1e-6) return false;
+    *factor = (int)rounded;
+    return true;
+}
+
+// Averages kx by ky blocks of 4-byte pixels starting at (src_x, src_y),
+// writing rows y0..y1 of the destination. With a factor of 1 this is a
+// plain copy; tile wraps the source instead of clamping to it.
+static void box_rows(const unsigned char* src, int src_w, int src_h, int src_x, int src_y,
+                     int kx, int ky, bool tile,
+                     unsigned char* dst, size_t dst_stride, int width, int y0, int y1) {
+    for (int y = y0; y < y1; ++y) {
+        unsigned char* out = dst + (size_t)(y - y0) * dst_stride;
+
+        if (kx == 1 && ky == 1) {
+            int sy = tile ? (src_y + y) % src_h : src_y + y;
+            const unsigned char* row = src + (size_t)sy * src_w * 4;
+            if (!tile) {
+                memcpy(out, row + (size_t)src_x * 4, (size_t)width * 4);
+                continue;
+            }
+            for (int x = 0; x < width; ) {
+                int sx = (src_x + x) % src_w;
+                int run = std::min(width - x, src_w - sx);
+                memcpy(out + (size_t)x * 4, row + (size_t)sx * 4, (size_t)run * 4);
+                x += run;
+            }
             continue;
         }
 
-        stbir_resize_uint8(data, img_w, img_h, 0, resized, m.width, m.height, 0, 4);
+        const unsigned int area = kx * ky;
+        const unsigned char* block_row = src + ((size_t)(src_y + y * ky) * src_w + src_x) * 4;
+        for (int x = 0; x < width; ++x) {
+            unsigned int sum[4] = { 0, 0, 0, 0 };
+            for (int by = 0; by < ky; ++by) {
+                const unsigned char* p = block_row + ((size_t)by * src_w + (size_t)x * kx) * 4;
+                for (int bx = 0; bx < kx; ++bx, p += 4) {
+                    sum[0] += p[0]; sum[1] += p[1]; sum[2] += p[2]; sum[3] += p[3];
+                }
+            }
+            for (int c = 0; c < 4; ++c) out[x * 4 + c] = (unsigned char)((sum[c] + area / 2) / area);
+        }
+    }
+}
+
+// Decodes and scales the image into job->img, splitting every placement into
+// horizontal stripes shared out across a few threads.
+static void render_wallpaper(WallpaperJob* job) {
+    job->ok = load_cached_wallpaper(job->cache_path, job->cache_key, job->img);
+    if (job->ok) return;
+
+    int img_w, img_h, channels;
+    unsigned char* data = stbi_load(job->path.c_str(), &img_w, &img_h, &channels, 4);
+    if (!data) {
+        std::cerr << "Failed to load image: " << job->path << "\n";
+        return;
+    }
+
+    // For the usual xRGB visuals convert the source once and let the resizer
+    // write into the XImage; otherwise each stripe goes through a scratch
+    // buffer and blit_rgba.
+    bool direct = is_direct_xrgb(job->img);
+    if (direct) convert_to_image_order(job->img, data, (uint32_t*)data, (size_t)img_w * img_h);
 
-        for (unsigned int y = 0; y < m.height; ++y) {
-            for (unsigned int x = 0; x < m.width; ++x) {
-                size_t src_idx = (y * m.width + x) * 4;
-                size_t dst_idx = ((m.y + y) * total_width + (m.x + x)) * 4;
-                memcpy(&final_img[dst_idx], &resized[src_idx], 4);
+    unsigned int thread_count = std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+
+    // Areas a placement leaves uncovered (fit, center) stay black: both
+    // the SHM segment and the calloc'd fallback start zeroed.
+    std::vector<Placement> placements;
+    if (job->span) {
+        placements.push_back(place_wallpaper(job->mode, 0, 0, job->width, job->height, img_w, img_h));
+    } else {
+        for (size_t i = 0; i < job->monitors.size(); ++i) {
+            const Monitor& m = job->monitors[i];
+
+            // Mirrored outputs share one region of the image; render it once.
+            bool duplicate = false;
+            for (size_t j = 0; j < i; ++j) {
+                const Monitor& o = job->monitors[j];
+                if (o.x == m.x && o.y == m.y && o.width == m.width && o.height == m.height) duplicate = true;
             }
+            if (duplicate) continue;
+
+            placements.push_back(place_wallpaper(job->mode, m.x, m.y, m.width, m.height, img_w, img_h));
         }
+    }
 
-        free(resized);
+    struct Stripe {
+        const Placement* placement;
+        int y0, y1;
+    };
+    std::vector<Stripe> stripes;
+    for (const Placement& p : placements) {
+        int rows = (p.dst_h + thread_count - 1) / thread_count;
+        for (int y = 0; y < p.dst_h; y += rows) {
+            stripes.push_back({&p, y, std::min(y + rows, p.dst_h)});
+        }
     }
 
+    std::atomic<size_t> next_stripe(0);
+    std::atomic<bool> complete(true);
+    auto work = [&]() {
+        for (size_t i = next_stripe++; i < stripes.size(); i = next_stripe++) {
+            const Stripe& stripe = stripes[i];
+            const Placement& p = *stripe.placement;
+            int rows = stripe.y1 - stripe.y0;
+
+            unsigned char* dst;
+            int dst_stride;
+            if (direct) {
+                dst = (unsigned char*)job->img->data +
+                      (size_t)(p.dst_y + stripe.y0) * job->img->bytes_per_line + (size_t)p.dst_x * 4;
+                dst_stride = job->img->bytes_per_line;
+            } else {
+                dst = (unsigned char*)malloc((size_t)p.dst_w * rows * 4);
+                dst_stride = p.dst_w * 4;
+                if (!dst) {
+                    std::cerr << "Memory allocation failed for monitor " << p.dst_w << "x" << p.dst_h << "\n";
+                    complete = false;
+                    continue;
+                }
+            }
+
+            // Whole-pixel copies and integer shrinks take the box kernel;
+            // anything else goes through stb's filter.
+            int kx, ky;
+            if (integer_downscale(p.scale_x, &kx) && integer_downscale(p.scale_y, &ky)) {
+                box_rows(data, img_w, img_h, (int)p.src_x, (int)p.src_y, kx, ky, p.tile,
+                         dst, dst_stride, p.dst_w, stripe.y0, stripe.y1);
+            } else {
+                stbir_resize_subpixel(data, img_w, img_h, 0, dst, p.dst_w, rows, dst_stride,
+                                      STBIR_TYPE_UINT8, 4, -1, 0,
+                                      STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+                                      STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT,
+                                      STBIR_COLORSPACE_LINEAR, nullptr,
+                                      (float)p.scale_x, (float)p.scale_y,
+                                      (float)(p.src_x * p.scale_x), (float)(p.src_y * p.scale_y + stripe.y0));
+            }
+
+            if (!direct) {
+                blit_rgba(job->img, dst, p.dst_x, p.dst_y + stripe.y0, p.dst_w, rows);
+                free(dst);
+            }
+        }
+    };
+
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 1; i < thread_count; ++i) helpers.emplace_back(work);
+    work();
+    for (std::thread& t : helpers) t.join();
+
     stbi_image_free(data);
-    data = nullptr;
+    if (complete) store_cached_wallpaper(job->cache_path, job->cache_key, job->img);
+    job->ok = true;
+}
 
-    int screen = DefaultScreen(display);
-    char* ximg_data = (char*)malloc(total_width * total_height * 4);
-    if (!ximg_data) {
-        std::cerr << "Failed to allocate XImage data\n";
-        free(final_img);
-        XCloseDisplay(display);
+static void start_wallpaper_job(const std::string& imagePath) {
+    struct stat image_stat;
+    if (stat(imagePath.c_str(), &image_stat) == -1) {
+        std::cerr << "Failed to load image: " << imagePath << "\n";
         return;
     }
 
-    XImage* img = XCreateImage(display, DefaultVisual(display, screen), 24, ZPixmap, 0,
-                             ximg_data, total_width, total_height, 32, 0);
-    if (!img) {
-        std::cerr << "Failed to create XImage\n";
-        free(ximg_data);
-        free(final_img);
-        XCloseDisplay(display);
+    WallpaperJob* job = new WallpaperJob();
+    job->path = imagePath;
+    job->monitors = get_monitors(display);
+    job->width = 0;
+    job->height = 0;
+    job->mode = wallpaper_mode;
+    job->span = wallpaper_span;
+
+    for (const Monitor& m : job->monitors) {
+        job->width = std::max(job->width, static_cast<unsigned int>(m.x + m.width));
+        job->height = std::max(job->height, static_cast<unsigned int>(m.y + m.height));
+    }
+
+    if (job->width == 0 || job->height == 0) {
+        std::cerr << "No active monitors to set wallpaper on\n";
+        delete job;
         return;
     }
 
-    for (unsigned int y = 0; y < total_height; ++y) {
-        for (unsigned int x = 0; x < total_width; ++x) {
-            size_t idx = (y * total_width + x) * 4;
-            unsigned char r = final_img[idx + 0];
-            unsigned char g = final_img[idx + 1];
-            unsigned char b = final_img[idx + 2];
-            unsigned long pixel = (r << 16) | (g << 8) | b;
-            XPutPixel(img, x, y, pixel);
+    int screen = DefaultScreen(display);
+    job->img = create_shm_image(display, screen, job->width, job->height, &job->shminfo);
+    job->shm = job->img != nullptr;
+
+    if (!job->shm) {
+        char* ximg_data = (char*)calloc((size_t)job->width * job->height * 4, 1);
+        if (!ximg_data) {
+            std::cerr << "Failed to allocate XImage data\n";
+            delete job;
+            return;
+        }
+
+        job->img = XCreateImage(display, DefaultVisual(display, screen), 24, ZPixmap, 0,
+                                ximg_data, job->width, job->height, 32, 0);
+        if (!job->img) {
+            std::cerr << "Failed to create XImage\n";
+            free(ximg_data);
+            delete job;
+            return;
         }
     }
 
-    free(final_img);
-    final_img = nullptr;
+    job->cache_path = get_wallpaper_cache_path();
+    job->cache_key = wallpaper_cache_key(imagePath, image_stat, job->monitors, job->img,
+                                         job->mode, job->span);
+    job->ok = false;
 
-    Pixmap pixmap = XCreatePixmap(display, root, total_width, total_height, DefaultDepth(display, screen));
-    if (pixmap) {
-        GC gc = XCreateGC(display, pixmap, 0, NULL);
-        XPutImage(display, pixmap, gc, img, 0, 0, 0, 0, total_width, total_height);
-        XFreeGC(display, gc);
+    wallpaper_job = job;
+    int fd = wallpaper_fd();
+    job->worker = std::thread([job, fd]() {
+        render_wallpaper(job);
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+            std::cerr << "Failed to signal wallpaper completion\n";
+        }
+    });
+}
 
-        XSetWindowBackgroundPixmap(display, root, pixmap);
-        XClearWindow(display, root);
-        XFlush(display);
-        XFreePixmap(display, pixmap);
-    }
+static void install_wallpaper(WallpaperJob* job) {
+    Window root = DefaultRootWindow(display);
+    int screen = DefaultScreen(display);
 
-    if (img) {
-        free(img->data);
-        img->data = nullptr;
-        XDestroyImage(img);
+    Pixmap pixmap = XCreatePixmap(display, root, job->width, job->height, DefaultDepth(display, screen));
+    if (!pixmap) return;
+
+    // Upload in bands so no single request makes the server copy the
+    // whole root image at once, whether through SHM or the wire.
+    GC gc = XCreateGC(display, pixmap, 0, NULL);
+    const unsigned int band = 128;
+    for (unsigned int y = 0; y < job->height; y += band) {
+        unsigned int rows = std::min(band, job->height - y);
+        if (job->shm) {
+            XShmPutImage(display, pixmap, gc, job->img, 0, y, 0, y, job->width, rows, False);
+        } else {
+            XPutImage(display, pixmap, gc, job->img, 0, y, 0, y, job->width, rows);
+        }
     }
+    XFreeGC(display, gc);
+
+    // Publish the pixmap so compositors and pseudo-transparent
+    // terminals can reuse it, and keep it alive until the next call.
+    XChangeProperty(display, root, wm_atoms[XROOTPMAP_ID], XA_PIXMAP, 32,
+                    PropModeReplace, (unsigned char*)&pixmap, 1);
+    XChangeProperty(display, root, wm_atoms[ESETROOT_PMAP_ID], XA_PIXMAP, 32,
+                    PropModeReplace, (unsigned char*)&pixmap, 1);
+    XSetWindowBackgroundPixmap(display, root, pixmap);
+    XClearWindow(display, root);
+
+    if (root_pixmap != None) XFreePixmap(display, root_pixmap);
+    root_pixmap = pixmap;
+    XFlush(display);
+}
+
+// Called from the event loop when wallpaper_fd() becomes readable.
+void finish_setpaper() {
+    uint64_t count;
+    if (read(wallpaper_fd(), &count, sizeof(count)) != sizeof(count)) return;
+    if (!wallpaper_job) return;
+
+    WallpaperJob* job = wallpaper_job;
+    wallpaper_job = nullptr;
+    job->worker.join();
+
+    // A newer request supersedes this render; don't flash the stale one.
+    if (job->ok && queued_wallpaper.empty()) install_wallpaper(job);
+    if (queued_wallpaper.empty()) report_layout_latency();
 
-    XCloseDisplay(display);
+    destroy_image(display, job->img, &job->shminfo, job->shm);
+    delete job;
     malloc_trim(0);
-}
\ No newline at end of file
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        std::cerr << "prism: wallpaper done, peak RSS " << usage.ru_maxrss << " KB\n";
+    }
+
+    if (!queued_wallpaper.empty()) {
+        std::string next = queued_wallpaper;
+        queued_wallpaper.clear();
+        start_wallpaper_job(next);
+    }
+}
+
+void setpaper(const std::string& imagePath) {
+    if (wallpaper_job) {
+        queued_wallpaper = imagePath;
+        return;
+    }
+    start_wallpaper_job(imagePath);
+}
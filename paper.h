@@ -1,3 +1,26 @@
 #pragma once
 
-void setpaper(const std::string& imagePath);
\ No newline at end of file
+#include <chrono>
+#include <string>
+
+// How the image is laid out on each monitor, or across all of them when
+// wallpaper_span is set.
+enum WallpaperMode {
+    WALLPAPER_STRETCH,
+    WALLPAPER_FILL,
+    WALLPAPER_FIT,
+    WALLPAPER_CENTER,
+    WALLPAPER_TILE,
+};
+
+extern WallpaperMode wallpaper_mode;
+extern bool wallpaper_span;
+
+void setpaper(const std::string& imagePath);
+int wallpaper_fd();
+void finish_setpaper();
+
+// Reports the time from a monitor change at start until the wallpaper for
+// the new layout is installed. rehome_ms and moved describe the synchronous
+// window re-homing that already happened.
+void time_layout_wallpaper(std::chrono::steady_clock::time_point start, long rehome_ms, int moved);
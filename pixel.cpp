@@ -0,0 +1,58 @@
+#include "pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Packs RGBA8888 pixels into 0x00RRGGBB words in host byte order.
+void rgba_to_xrgb_scalar(const unsigned char* src, uint32_t* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char* p = src + i * 4;
+        dst[i] = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    }
+}
+
+#if defined(__SSE2__)
+void rgba_to_xrgb_sse2(const unsigned char* src, uint32_t* dst, size_t count) {
+    const __m128i low = _mm_set1_epi32(0xff);
+    const __m128i mid = _mm_set1_epi32(0xff00);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        __m128i r = _mm_slli_epi32(_mm_and_si128(px, low), 16);
+        __m128i g = _mm_and_si128(px, mid);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(px, 16), low);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_or_si128(r, g), b));
+    }
+    rgba_to_xrgb_scalar(src + i * 4, dst + i, count - i);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+void rgba_to_xrgb_avx2(const unsigned char* src, uint32_t* dst, size_t count) {
+    const __m256i low = _mm256_set1_epi32(0xff);
+    const __m256i mid = _mm256_set1_epi32(0xff00);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        __m256i r = _mm256_slli_epi32(_mm256_and_si256(px, low), 16);
+        __m256i g = _mm256_and_si256(px, mid);
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(px, 16), low);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_or_si256(r, g), b));
+    }
+    rgba_to_xrgb_scalar(src + i * 4, dst + i, count - i);
+}
+#endif
+
+ConvertRow pick_row_converter() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return rgba_to_xrgb_avx2;
+#endif
+#if defined(__SSE2__)
+    return rgba_to_xrgb_sse2;
+#else
+    return rgba_to_xrgb_scalar;
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+typedef void (*ConvertRow)(const unsigned char* src, uint32_t* dst, size_t count);
+
+void rgba_to_xrgb_scalar(const unsigned char* src, uint32_t* dst, size_t count);
+#if defined(__SSE2__)
+void rgba_to_xrgb_sse2(const unsigned char* src, uint32_t* dst, size_t count);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+void rgba_to_xrgb_avx2(const unsigned char* src, uint32_t* dst, size_t count);
+#endif
+
+// Fastest row converter the CPU supports.
+ConvertRow pick_row_converter();
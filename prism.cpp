@@ -10,12 +10,17 @@
 #include <algorithm>
 #include <csignal>
 #include <cstring>
+#include <chrono>
+#include <poll.h>
 
 #include "config.h"
 #include "launch.h"
 #include "monitor.h"
 #include "window.h"
 #include "lock.h"
+#include "paper.h"
+#include "keys.h"
+#include "client.h"
 
 Display* display = nullptr;
 Window root;
@@ -25,7 +30,13 @@ const char* display_name = nullptr;
 bool running = true;
 bool resize_mode = false;
 
-std::vector<Window> managed_windows;
+// Interactive move/resize applies at most one motion per monitor frame.
+std::chrono::steady_clock::duration motion_interval{0};
+std::chrono::steady_clock::time_point last_motion_applied;
+XMotionEvent pending_motion;
+bool motion_pending = false;
+unsigned long drag_motion_seen = 0;
+unsigned long drag_motion_applied = 0;
 
 
 int parse_modifier(const std::string& mod) {
@@ -74,27 +85,149 @@ Window get_toplevel_window(Display* dpy, Window w) {
 }
 
 void handle_key_press(XKeyEvent* ev) {
-    KeyCode keycode = ev->keycode;
-    unsigned int state = ev->state & (ShiftMask | ControlMask | Mod1Mask | Mod4Mask);
+    const Action* action = lookup_key_action(ev->keycode, ev->state);
+    if (!action) return;
+
+    Client* focused = nullptr;
+    switch (action->type) {
+        case ACTION_CLOSE:
+        case ACTION_MAXIMIZE:
+        case ACTION_FULLSCREEN:
+        case ACTION_MOVE_TO_MONITOR:
+            focused = focused_client();
+            if (!focused) return;
+            break;
+        default:
+            break;
+    }
 
-    KeySym keysym = XkbKeycodeToKeysym(display, keycode, 0, 0);
-    if (keysym == XK_l && state == Mod4Mask) {
-        lock();
+    switch (action->type) {
+        case ACTION_EXEC:
+            launch(action->command.c_str(), 0, 0, display_name);
+            break;
+        case ACTION_EXEC_RAW:
+            launch_argv(action->argv, 0, 0, display_name);
+            break;
+        case ACTION_CLOSE:
+            close_client(focused);
+            break;
+        case ACTION_MAXIMIZE:
+            toggle_client_state(focused, wm_atoms[NET_WM_STATE_MAXIMIZED_VERT], wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ]);
+            break;
+        case ACTION_FULLSCREEN:
+            toggle_client_state(focused, wm_atoms[NET_WM_STATE_FULLSCREEN], None);
+            break;
+        case ACTION_MOVE_TO_MONITOR:
+            move_client_to_monitor(focused, action->monitor);
+            break;
+        case ACTION_FOCUS_NEXT:
+            focus_next_client();
+            break;
+        case ACTION_LOCK:
+            lock();
+            break;
+        case ACTION_RELOAD:
+            reload_config(display, root);
+            break;
+    }
+}
+
+void flush_motion() {
+    if (!motion_pending) return;
+    motion_pending = false;
+    last_motion_applied = std::chrono::steady_clock::now();
+    ++drag_motion_applied;
+    handle_motion_notify(&pending_motion);
+}
+
+void handle_motion(XEvent* ev) {
+    bool interactive = drag_in_progress || resize_in_progress;
+    if (interactive) ++drag_motion_seen;
+
+    // Only the newest pointer position matters; drop motion events queued
+    // directly behind this one.
+    while (XEventsQueued(display, QueuedAfterReading) > 0) {
+        XEvent next;
+        XPeekEvent(display, &next);
+        if (next.type != MotionNotify) break;
+        XNextEvent(display, ev);
+        if (interactive) ++drag_motion_seen;
+    }
+
+    if (!interactive) {
+        handle_motion_notify(&ev->xmotion);
         return;
     }
 
-    auto it = keybindings.find({keycode, state});
-    if (it != keybindings.end()) {
-        const std::string& cmd = it->second;
-        launch(cmd.c_str(), 0, 0, display_name);
+    pending_motion = ev->xmotion;
+    motion_pending = true;
+    if (std::chrono::steady_clock::now() - last_motion_applied >= motion_interval) {
+        flush_motion();
+    }
+}
+
+// Reports once per drag how many configures coalescing saved.
+void report_motion_coalescing() {
+    if (drag_motion_seen > 0) {
+        std::cerr << "prism: applied " << drag_motion_applied << " of " << drag_motion_seen
+                  << " motion events, saved " << drag_motion_seen - drag_motion_applied
+                  << " configures\n";
+    }
+    drag_motion_seen = 0;
+    drag_motion_applied = 0;
+}
+
+// Waits for the next X event while servicing the wallpaper worker, config
+// reloads and exited children, and applies a deferred motion once its frame
+// slot comes up. Returns false if the wait ended without a queued X event.
+bool wait_for_event() {
+    if (XPending(display)) return true;
+
+    int timeout = -1;
+    if (motion_pending) {
+        auto deadline = last_motion_applied + motion_interval;
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count() + 1;
+        if (remaining <= 0) {
+            flush_motion();
+            return false;
+        }
+        timeout = (int)remaining;
+    }
+
+    struct pollfd fds[4] = {
+        { ConnectionNumber(display), POLLIN, 0 },
+        { wallpaper_fd(), POLLIN, 0 },
+        { config_fd(), POLLIN, 0 },
+        { child_fd(), POLLIN, 0 },
+    };
+    int ready = poll(fds, 4, timeout);
+    if (ready < 0) return false;
+    if (ready == 0) {
+        flush_motion();
+        return false;
+    }
+
+    if (fds[1].revents & POLLIN) finish_setpaper();
+    if (fds[2].revents & POLLIN) handle_config_change(display, root);
+    if (fds[3].revents & POLLIN) reap_children();
+    return (fds[0].revents & POLLIN) || XPending(display);
+}
+
+void update_motion_interval() {
+    double refresh_rate = get_primary_refresh_rate(display);
+    motion_interval = std::chrono::steady_clock::duration::zero();
+    if (refresh_rate > 0) {
+        motion_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / refresh_rate));
     }
 }
 
 int main() {
     display_name = getenv("DISPLAY");
+    init_supervisor();
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
-    signal(SIGCHLD, SIG_IGN);
     atexit(cleanup);
     display = XOpenDisplay(display_name);
     if (!display) {
@@ -119,6 +252,9 @@ int main() {
         ClientMessage);  
 
 
+    init_atoms();
+    init_monitors(display);
+
     load_config(display, root);
     if (!xrandr_command.empty()) {
         std::string full_cmd = "xrandr " + xrandr_command;
@@ -128,17 +264,28 @@ int main() {
     for (const std::string& cmd : startup_commands) {
         launch(cmd.c_str(), 0, 0, display_name);
     }
+    sync_respawn_commands(respawn_commands, display_name);
 
-    init_atoms();
+    init_decorations();
+
+    update_motion_interval();
 
     XFlush(display);
     Cursor cursor = XCreateFontCursor(display, XC_left_ptr);
     XDefineCursor(display, root, cursor);
 
     while(running){
+        if (monitor_layout_pending() && !XPending(display)) {
+            if (apply_monitor_layout(display)) update_motion_interval();
+        }
+
+        if (!wait_for_event()) continue;
+
         XEvent ev;
         XNextEvent(display, &ev);
 
+        if (handle_monitor_event(&ev)) continue;
+
         switch (ev.type) {
             case MapRequest:
                 handle_map_request(&ev.xmaprequest);
@@ -153,10 +300,12 @@ int main() {
                 handle_button_press(&ev.xbutton);
                 break;
             case ButtonRelease:
+                flush_motion();
+                report_motion_coalescing();
                 handle_button_release(&ev.xbutton);
                 break;
             case MotionNotify:
-                handle_motion_notify(&ev.xmotion);
+                handle_motion(&ev);
                 break;
             case Expose:
                 handle_expose(&ev.xexpose);
@@ -167,20 +316,24 @@ int main() {
             case PropertyNotify:
                 handle_property_notify(&ev.xproperty);
                 break;
-            case ConfigureRequest: {
-                XConfigureRequestEvent* req = &ev.xconfigurerequest;
-                XWindowChanges changes;
-                changes.x = req->x;
-                changes.y = req->y;
-                changes.width = req->width;
-                changes.height = req->height;
-                changes.border_width = req->border_width;
-                changes.sibling = req->above;
-                changes.stack_mode = req->detail;
-
-                XConfigureWindow(display, req->window, req->value_mask, &changes);
+            case ConfigureNotify:
+                handle_configure_notify(&ev.xconfigure);
+                break;
+            case MapNotify:
+                handle_map_notify(&ev.xmap);
+                break;
+            case UnmapNotify:
+                handle_unmap_notify(&ev.xunmap);
+                break;
+            case FocusIn:
+                handle_focus_in(&ev.xfocus);
+                break;
+            case FocusOut:
+                handle_focus_out(&ev.xfocus);
+                break;
+            case ConfigureRequest:
+                handle_configure_request(&ev.xconfigurerequest);
                 break;
-            }
 
         }
 
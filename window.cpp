@@ -2,7 +2,12 @@
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <X11/cursorfont.h>
+#include <X11/Xft/Xft.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
 
+#include "client.h"
+#include "launch.h"
 #include "monitor.h"
 #include "window.h"
 
@@ -12,7 +17,6 @@
 #include <unordered_map>
 
 extern Display* display;
-extern std::vector<Window> managed_windows;
 extern Window root;
 
 
@@ -26,19 +30,33 @@ const int MAXIMIZE_BUTTON_SIZE = 16;
 const int MAXIMIZE_BUTTON_MARGIN = CLOSE_BUTTON_MARGIN + CLOSE_BUTTON_SIZE + 4;
 
 
-Atom net_wm_state;
-Atom net_wm_state_fullscreen;
-Atom net_wm_state_maximized_vert;
-Atom net_wm_state_maximized_horz;
-Atom net_client_list;
-
-struct WindowPair {
-    Window frame;
-    Window client;
-    GC gc;
+// Must stay in the same order as enum AtomId in window.h.
+static const char* atom_names[ATOM_COUNT] = {
+    "_NET_WM_STATE",
+    "_NET_WM_STATE_FULLSCREEN",
+    "_NET_WM_STATE_MAXIMIZED_VERT",
+    "_NET_WM_STATE_MAXIMIZED_HORZ",
+    "_NET_WM_MOVERESIZE",
+    "_NET_CLIENT_LIST",
+    "_NET_ACTIVE_WINDOW",
+    "_MOTIF_WM_HINTS",
+    "WM_PROTOCOLS",
+    "WM_DELETE_WINDOW",
+    "WM_CLIENT_LEADER",
+    "_XROOTPMAP_ID",
+    "ESETROOT_PMAP_ID",
+    "_NET_WM_PID",
 };
 
-std::vector<WindowPair> framed_windows;
+Atom wm_atoms[ATOM_COUNT];
+
+XftFont* title_font = nullptr;
+XftColor title_color;
+int title_baseline = 0;
+
+// Client holding the keyboard focus, kept current from FocusIn/FocusOut so
+// key bindings usually don't have to ask the server.
+static Client* focused = nullptr;
 
 bool drag_in_progress = false;
 Window drag_window = None;
@@ -75,21 +93,47 @@ unsigned int orig_win_h = 0;
 const int RESIZE_BORDER_WIDTH = 6; 
 
 void draw_title_bar(Window frame);
+void update_client_title(Client* c);
 void handle_expose(XExposeEvent* ev);
 void handle_pointer_motion(Window frame, int x, int y);
-WindowPair* find_framed_window(Window w);
-ResizeDirection get_resize_direction(WindowPair* wp, int x, int y);
+Client* find_framed_window(Window w);
+Client* find_toplevel_client(Window w);
+bool get_window_geometry(Window w, int* x, int* y, int* width, int* height);
+ResizeDirection get_resize_direction(Client* c, int x, int y);
 void update_cursor(Window frame, ResizeDirection dir);
 void start_window_resize(Window win, int x_root, int y_root, ResizeDirection dir);
 void end_window_resize();
 
 void init_atoms() {
-    net_wm_state = XInternAtom(display, "_NET_WM_STATE", False);
-    Atom net_wm_moveresize = XInternAtom(display, "_NET_WM_MOVERESIZE", False);
-    net_wm_state_fullscreen = XInternAtom(display, "_NET_WM_STATE_FULLSCREEN", False);
-    net_wm_state_maximized_vert = XInternAtom(display, "_NET_WM_STATE_MAXIMIZED_VERT", False);
-    net_wm_state_maximized_horz = XInternAtom(display, "_NET_WM_STATE_MAXIMIZED_HORZ", False);
-    net_client_list = XInternAtom(display, "_NET_CLIENT_LIST", False);
+    XInternAtoms(display, const_cast<char**>(atom_names), ATOM_COUNT, False, wm_atoms);
+}
+
+void init_decorations() {
+    int screen = DefaultScreen(display);
+    title_font = XftFontOpenName(display, screen, "monospace-9");
+    if (!title_font) return;
+
+    XRenderColor white = { 0xffff, 0xffff, 0xffff, 0xffff };
+    XftColorAllocValue(display, DefaultVisual(display, screen), DefaultColormap(display, screen),
+                       &white, &title_color);
+    title_baseline = (TITLE_BAR_HEIGHT + title_font->ascent - title_font->descent) / 2;
+}
+
+void update_client_title(Client* c) {
+    c->title.clear();
+    c->title_width = 0;
+
+    char* name = nullptr;
+    if (XFetchName(display, c->window, &name) && name) {
+        c->title = name;
+        XFree(name);
+    }
+
+    if (title_font && !c->title.empty()) {
+        XGlyphInfo extents;
+        XftTextExtents8(display, title_font, (const FcChar8*)c->title.c_str(), c->title.size(), &extents);
+        c->title_width = extents.xOff;
+    }
 }
 
 void start_window_drag(Window win, int x_root, int y_root) {
@@ -101,29 +145,24 @@ void start_window_drag(Window win, int x_root, int y_root) {
     unsigned long nitems, bytes_after;
     unsigned char* prop = nullptr;
 
-    if (XGetWindowProperty(display, win, net_wm_state, 0, (~0L), False, XA_ATOM,
+    if (XGetWindowProperty(display, win, wm_atoms[NET_WM_STATE], 0, (~0L), False, XA_ATOM,
                            &actual_type, &actual_format, &nitems, &bytes_after, &prop) == Success && prop) {
         bool is_max_vert = false;
         bool is_max_horz = false;
 
         Atom* atoms = (Atom*)prop;
         for (unsigned long i = 0; i < nitems; ++i) {
-            if (atoms[i] == net_wm_state_maximized_vert) is_max_vert = true;
-            if (atoms[i] == net_wm_state_maximized_horz) is_max_horz = true;
+            if (atoms[i] == wm_atoms[NET_WM_STATE_MAXIMIZED_VERT]) is_max_vert = true;
+            if (atoms[i] == wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ]) is_max_horz = true;
         }
 
         XFree(prop);
 
         if (is_max_vert || is_max_horz) {
             Window client = win;
-            for (const auto& wp : framed_windows) {
-                if (wp.frame == win) {
-                    client = wp.client;
-                    break;
-                }
-            }
+            if (Client* c = find_framed_window(win)) client = c->window;
 
-            Atom wm_state = XInternAtom(display, "_NET_WM_STATE", False);
+            Atom wm_state = wm_atoms[NET_WM_STATE];
 
             XEvent e = {};
             e.xclient.type = ClientMessage;
@@ -131,8 +170,8 @@ void start_window_drag(Window win, int x_root, int y_root) {
             e.xclient.message_type = wm_state;
             e.xclient.format = 32;
             e.xclient.data.l[0] = 0;
-            e.xclient.data.l[1] = net_wm_state_maximized_vert;
-            e.xclient.data.l[2] = net_wm_state_maximized_horz;
+            e.xclient.data.l[1] = wm_atoms[NET_WM_STATE_MAXIMIZED_VERT];
+            e.xclient.data.l[2] = wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ];
             e.xclient.data.l[3] = 1;
             e.xclient.data.l[4] = 0;
 
@@ -141,10 +180,10 @@ void start_window_drag(Window win, int x_root, int y_root) {
         }
     }
 
-    XWindowAttributes attr;
-    XGetWindowAttributes(display, win, &attr);
-    drag_offset_x = x_root - attr.x;
-    drag_offset_y = y_root - attr.y;
+    int win_x = 0, win_y = 0, win_w, win_h;
+    get_window_geometry(win, &win_x, &win_y, &win_w, &win_h);
+    drag_offset_x = x_root - win_x;
+    drag_offset_y = y_root - win_y;
 
     XGrabPointer(display, drag_window, True,
                  PointerMotionMask | ButtonReleaseMask,
@@ -180,35 +219,33 @@ Window create_frame_window(Window client, int x, int y, int width, int height) {
     XResizeWindow(display, client, width, height);
 
     //Shit function
-    XSelectInput(display, client, StructureNotifyMask | PropertyChangeMask); 
+    XSelectInput(display, client, StructureNotifyMask | PropertyChangeMask | FocusChangeMask); 
 
     XGrabButton(display, Button1, AnyModifier, client,
             False, ButtonPressMask,
             GrabModeSync, GrabModeSync,
             None, None);
 
-    Atom client_leader = XInternAtom(display, "WM_CLIENT_LEADER", False);
+    Atom client_leader = wm_atoms[WM_CLIENT_LEADER];
     XChangeProperty(display, frame, client_leader, XA_WINDOW, 32,
                     PropModeReplace, (unsigned char*)&frame, 1);
 
-    draw_title_bar(frame);
+    Client* c = add_client(frame, client, gc, x, y, width, height + TITLE_BAR_HEIGHT);
+    int screen = DefaultScreen(display);
+    c->draw = XftDrawCreate(display, frame, DefaultVisual(display, screen), DefaultColormap(display, screen));
+    update_client_title(c);
 
     XMapWindow(display, frame);
     XMapWindow(display, client);
 
-    framed_windows.push_back({frame, client, gc});
     return frame;
 }
 
 void draw_title_bar(Window frame) {
-    auto it = std::find_if(framed_windows.begin(), framed_windows.end(),
-                           [frame](const WindowPair& wp) { return wp.frame == frame; });
-    if (it == framed_windows.end()) return;
+    Client* it = find_framed_window(frame);
+    if (!it) return;
 
-    XWindowAttributes attr;
-    XGetWindowAttributes(display, frame, &attr);
-
-    int width = attr.width;
+    int width = it->width;
 
      
     XSetForeground(display, it->gc, BlackPixel(display, DefaultScreen(display)));
@@ -218,6 +255,17 @@ void draw_title_bar(Window frame) {
     int max_x = width - MAXIMIZE_BUTTON_MARGIN - MAXIMIZE_BUTTON_SIZE;
     int max_y = (TITLE_BAR_HEIGHT - MAXIMIZE_BUTTON_SIZE) / 2;
 
+    if (title_font && it->draw && !it->title.empty()) {
+        XftDrawString8(it->draw, &title_color, title_font, 10, title_baseline,
+                       (const FcChar8*)it->title.c_str(), it->title.size());
+
+        // Long titles would otherwise run underneath the buttons.
+        if (10 + it->title_width > max_x - 4) {
+            XSetForeground(display, it->gc, BlackPixel(display, DefaultScreen(display)));
+            XFillRectangle(display, frame, it->gc, max_x - 4, 0, width - max_x + 4, TITLE_BAR_HEIGHT);
+        }
+    }
+
     unsigned long gray = 0x888888;
     XSetForeground(display, it->gc, gray);
     XFillRectangle(display, frame, it->gc, max_x, max_y, MAXIMIZE_BUTTON_SIZE, MAXIMIZE_BUTTON_SIZE);
@@ -237,45 +285,56 @@ void draw_title_bar(Window frame) {
     XSetForeground(display, it->gc, WhitePixel(display, DefaultScreen(display)));
     XDrawLine(display, frame, it->gc, close_x, close_y, close_x + CLOSE_BUTTON_SIZE, close_y + CLOSE_BUTTON_SIZE);
     XDrawLine(display, frame, it->gc, close_x + CLOSE_BUTTON_SIZE, close_y, close_x, close_y + CLOSE_BUTTON_SIZE);
-
-     
-    char* name = nullptr;
-    if (XFetchName(display, it->client, &name) && name) {
-        XFontStruct* font = XLoadQueryFont(display, "fixed");
-        if (font) {
-            XSetFont(display, it->gc, font->fid);
-            XSetForeground(display, it->gc, WhitePixel(display, DefaultScreen(display)));
-            XDrawString(display, frame, it->gc, 10, TITLE_BAR_HEIGHT / 2 + 5, name, strlen(name));
-            XFreeFont(display, font);
-        }
-        XFree(name);
-    }
 }
 
 
 
-WindowPair* find_framed_window(Window w) {
-    for (auto& wp : framed_windows) {
-        if (wp.frame == w) return &wp;
-    }
+Client* find_framed_window(Window w) {
+    Client* c = find_client(w);
+    if (c && c->frame == w) return c;
     return nullptr;
 }
 
-ResizeDirection get_resize_direction(WindowPair* wp, int x, int y) {
-    if (!wp) return RESIZE_NONE;
+// Returns the client whose top-level window (frame, or the client itself
+// when undecorated) is w.
+Client* find_toplevel_client(Window w) {
+    Client* c = find_client(w);
+    if (c && (c->frame == w || c->frame == None)) return c;
+    return nullptr;
+}
+
+// Geometry of a top-level window, served from the client cache when the
+// window is managed and only asking the server for unmanaged windows.
+bool get_window_geometry(Window w, int* x, int* y, int* width, int* height) {
+    if (Client* c = find_toplevel_client(w)) {
+        *x = c->x;
+        *y = c->y;
+        *width = c->width;
+        *height = c->height;
+        return true;
+    }
 
     XWindowAttributes attr;
-    XGetWindowAttributes(display, wp->frame, &attr);
+    if (!XGetWindowAttributes(display, w, &attr)) return false;
+    *x = attr.x;
+    *y = attr.y;
+    *width = attr.width;
+    *height = attr.height;
+    return true;
+}
+
+ResizeDirection get_resize_direction(Client* c, int x, int y) {
+    if (!c) return RESIZE_NONE;
 
     ResizeDirection dir = RESIZE_NONE;
     if (x >= 0 && x <= RESIZE_BORDER_WIDTH)
         dir = (ResizeDirection)(dir | RESIZE_LEFT);
-    else if (x >= (int)attr.width - RESIZE_BORDER_WIDTH)   
+    else if (x >= c->width - RESIZE_BORDER_WIDTH)   
         dir = (ResizeDirection)(dir | RESIZE_RIGHT);
 
     if (y >= 0 && y <= RESIZE_BORDER_WIDTH)
         dir = (ResizeDirection)(dir | RESIZE_TOP);
-    else if (y >= (int)attr.height - RESIZE_BORDER_WIDTH)
+    else if (y >= c->height - RESIZE_BORDER_WIDTH)
         dir = (ResizeDirection)(dir | RESIZE_BOTTOM);
 
     return dir;
@@ -315,12 +374,12 @@ void start_window_resize(Window win, int x_root, int y_root, ResizeDirection dir
     resize_start_x = x_root;
     resize_start_y = y_root;
 
-    XWindowAttributes attr;
-    XGetWindowAttributes(display, win, &attr);
-    orig_win_x = attr.x;
-    orig_win_y = attr.y;
-    orig_win_w = attr.width;
-    orig_win_h = attr.height;
+    int win_x = 0, win_y = 0, win_w = 0, win_h = 0;
+    get_window_geometry(win, &win_x, &win_y, &win_w, &win_h);
+    orig_win_x = win_x;
+    orig_win_y = win_y;
+    orig_win_w = win_w;
+    orig_win_h = win_h;
 }
 
 void end_window_resize() {
@@ -329,89 +388,143 @@ void end_window_resize() {
     resize_dir = RESIZE_NONE;
 }
 
+void move_resize_client(Client* c, int x, int y, int width, int height) {
+    if (c->frame != None) {
+        XMoveResizeWindow(display, c->frame, x, y, width, height);
+        XResizeWindow(display, c->window, width, height - TITLE_BAR_HEIGHT);
+    } else {
+        XMoveResizeWindow(display, c->window, x, y, width, height);
+    }
+
+    c->x = x;
+    c->y = y;
+    c->width = width;
+    c->height = height;
+}
+
 void update_net_client_list() {
-    if (managed_windows.empty()) {
-        XDeleteProperty(display, root, net_client_list);
+    const std::list<Client>& clients = all_clients();
+    if (clients.empty()) {
+        XDeleteProperty(display, root, wm_atoms[NET_CLIENT_LIST]);
         return;
     }
 
-    XChangeProperty(display, root, net_client_list, XA_WINDOW, 32,
+    std::vector<Window> managed_windows;
+    managed_windows.reserve(clients.size());
+    for (const Client& c : clients) {
+        managed_windows.push_back(c.frame != None ? c.frame : c.window);
+    }
+
+    XChangeProperty(display, root, wm_atoms[NET_CLIENT_LIST], XA_WINDOW, 32,
                     PropModeReplace,
                     (unsigned char*)managed_windows.data(),
                     managed_windows.size());
 }
 
+// Checks whether an _NET_WM_STATE property reply lists the given state.
+static bool reply_has_atom(xcb_get_property_reply_t* reply, Atom atom) {
+    if (!reply || reply->format != 32) return false;
+
+    const uint32_t* atoms = (const uint32_t*)xcb_get_property_value(reply);
+    int count = xcb_get_property_value_length(reply) / 4;
+    for (int i = 0; i < count; ++i) {
+        if (atoms[i] == atom) return true;
+    }
+    return false;
+}
+
 void handle_map_request(XMapRequestEvent* ev) {
     Window w = ev->window;
 
-    XWindowAttributes attr;
-    XGetWindowAttributes(display, w, &attr);
-    if (attr.override_redirect) {
-        XMapWindow(display, w);
+    if (Client* c = find_client(w)) {
+        XMapWindow(display, c->frame != None ? c->frame : w);
         return;
     }
 
-    for (const auto& wp : framed_windows) {
-        if (wp.client == w) {
-            XMapWindow(display, wp.frame);
-            return;
-        }
+    // Send every request the placement decision needs up front and only
+    // then wait, so a new window costs one round-trip instead of five.
+    xcb_connection_t* conn = XGetXCBConnection(display);
+    xcb_get_window_attributes_cookie_t attr_cookie = xcb_get_window_attributes(conn, w);
+    xcb_get_geometry_cookie_t geom_cookie = xcb_get_geometry(conn, w);
+    xcb_get_property_cookie_t motif_cookie = xcb_get_property(conn, 0, w,
+        wm_atoms[MOTIF_WM_HINTS], wm_atoms[MOTIF_WM_HINTS], 0, 5);
+    xcb_get_property_cookie_t state_cookie = xcb_get_property(conn, 0, w,
+        wm_atoms[NET_WM_STATE], XA_ATOM, 0, UINT32_MAX);
+    xcb_get_property_cookie_t hints_cookie = xcb_get_property(conn, 0, w,
+        XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 0, 18);
+    xcb_get_property_cookie_t pid_cookie = xcb_get_property(conn, 0, w,
+        wm_atoms[NET_WM_PID], XA_CARDINAL, 0, 1);
+
+    xcb_generic_error_t* err = nullptr;
+    xcb_get_window_attributes_reply_t* attr = xcb_get_window_attributes_reply(conn, attr_cookie, &err);
+    free(err);
+    err = nullptr;
+    xcb_get_geometry_reply_t* geom = xcb_get_geometry_reply(conn, geom_cookie, &err);
+    free(err);
+    err = nullptr;
+    xcb_get_property_reply_t* motif = xcb_get_property_reply(conn, motif_cookie, &err);
+    free(err);
+    err = nullptr;
+    xcb_get_property_reply_t* state = xcb_get_property_reply(conn, state_cookie, &err);
+    free(err);
+    err = nullptr;
+    xcb_get_property_reply_t* size_hints = xcb_get_property_reply(conn, hints_cookie, &err);
+    free(err);
+    err = nullptr;
+    xcb_get_property_reply_t* pid = xcb_get_property_reply(conn, pid_cookie, &err);
+    free(err);
+
+    if (pid && pid->format == 32 && xcb_get_property_value_length(pid) >= 4) {
+        note_child_window(*(const uint32_t*)xcb_get_property_value(pid));
+    }
+    free(pid);
+
+    if (!attr || !geom || attr->override_redirect) {
+        if (attr && attr->override_redirect) XMapWindow(display, w);
+        free(attr);
+        free(geom);
+        free(motif);
+        free(state);
+        free(size_hints);
+        return;
     }
 
     bool wants_no_decor = false;
-    bool wants_fullscreen = false;
+    bool wants_fullscreen = reply_has_atom(state, wm_atoms[NET_WM_STATE_FULLSCREEN]);
 
-     
-    Atom motifHints = XInternAtom(display, "_MOTIF_WM_HINTS", False);
-    Atom actual_type;
-    int actual_format;
-    unsigned long nitems, bytes_after;
-    unsigned char* prop = nullptr;
-
-    if (XGetWindowProperty(display, w, motifHints, 0, 5, False, motifHints,
-                           &actual_type, &actual_format, &nitems,
-                           &bytes_after, &prop) == Success && prop) {
-        if (nitems >= 5) {
-            unsigned long* hints = (unsigned long*)prop;
-            if ((hints[0] & MWM_HINTS_DECORATIONS) && hints[2] == 0) {
-                wants_no_decor = true;
-            }
+    if (motif && motif->format == 32 && xcb_get_property_value_length(motif) >= 5 * 4) {
+        const uint32_t* hints = (const uint32_t*)xcb_get_property_value(motif);
+        if ((hints[0] & MWM_HINTS_DECORATIONS) && hints[2] == 0) {
+            wants_no_decor = true;
         }
-        XFree(prop);
     }
 
-     
-    if (XGetWindowProperty(display, w, net_wm_state, 0, (~0L), False, XA_ATOM,
-                           &actual_type, &actual_format, &nitems, &bytes_after, &prop) == Success && prop) {
-        Atom* atoms = (Atom*)prop;
-        for (unsigned long i = 0; i < nitems; ++i) {
-            if (atoms[i] == net_wm_state_fullscreen) {
-                wants_fullscreen = true;
-                break;
-            }
-        }
-        XFree(prop);
-    }
-
-    int width = attr.width;
-    int height = attr.height;
+    int width = geom->width;
+    int height = geom->height;
     if (width < 100 || height < 100) {
         width = 800;
         height = 600;
     }
 
-    XSizeHints hints;
-    long supplied;
-    if (XGetWMNormalHints(display, w, &hints, &supplied)) {
-        if (hints.flags & PSize) {
-            width = hints.width;
-            height = hints.height;
-        } else if (hints.flags & PMinSize) {
-            width = std::max(width, hints.min_width);
-            height = std::max(height, hints.min_height);
+    // WM_NORMAL_HINTS is an XSizeHints laid out as flags, x, y, width,
+    // height, min_width, min_height, ...
+    if (size_hints && size_hints->format == 32 && xcb_get_property_value_length(size_hints) >= 7 * 4) {
+        const int32_t* hints = (const int32_t*)xcb_get_property_value(size_hints);
+        if (hints[0] & PSize) {
+            width = hints[3];
+            height = hints[4];
+        } else if (hints[0] & PMinSize) {
+            width = std::max(width, (int)hints[5]);
+            height = std::max(height, (int)hints[6]);
         }
     }
 
+    free(attr);
+    free(geom);
+    free(motif);
+    free(state);
+    free(size_hints);
+
     int mon_x, mon_y, mon_w, mon_h;
     if (!get_primary_monitor_geometry(display, &mon_x, &mon_y, &mon_w, &mon_h)) {
         mon_x = mon_y = 0;
@@ -425,47 +538,44 @@ void handle_map_request(XMapRequestEvent* ev) {
     if (wants_no_decor || wants_fullscreen) {
         XMoveResizeWindow(display, w, win_x, win_y, width, height);
         XMapWindow(display, w);
-        XSelectInput(display, w, StructureNotifyMask);
-        managed_windows.push_back(w);
+        XSelectInput(display, w, StructureNotifyMask | FocusChangeMask);
+        add_client(None, w, None, win_x, win_y, width, height);
         update_net_client_list();
     } else {
-        Window frame = create_frame_window(w, win_x, win_y, width, height);
-        managed_windows.push_back(frame);
+        create_frame_window(w, win_x, win_y, width, height);
         update_net_client_list();
     }
 }
 
 void handle_destroy_notify(XDestroyWindowEvent* ev) {
-    auto it = std::find_if(framed_windows.begin(), framed_windows.end(),
-        [ev](const WindowPair& wp) { return wp.frame == ev->window || wp.client == ev->window; });
+    Client* c = find_client(ev->window);
+    if (!c) return;
 
-    if (it != framed_windows.end()) {
-        if (it->frame != ev->window) {
-            XDestroyWindow(display, it->frame);
+    if (c->frame != None) {
+        if (c->frame != ev->window) {
+            XDestroyWindow(display, c->frame);
         }
-        if (it->client != ev->window) {
-            XDestroyWindow(display, it->client);
+        if (c->window != ev->window) {
+            XDestroyWindow(display, c->window);
         }
 
-        XFreeGC(display, it->gc);
-        framed_windows.erase(it);
-        update_net_client_list();
+        if (c->draw) XftDrawDestroy(c->draw);
+        XFreeGC(display, c->gc);
     }
 
-    managed_windows.erase(
-        std::remove(managed_windows.begin(), managed_windows.end(), ev->window),
-        managed_windows.end()
-    );
+    if (focused == c) focused = nullptr;
+    remove_client(c);
+    update_net_client_list();
 }
 
 
 void raise_and_focus_window(Window win) {
-    WindowPair* wp = find_framed_window(win);
+    Client* wp = find_framed_window(win);
     Window client = win;
     Window frame = win;
 
     if (wp) {
-        client = wp->client;
+        client = wp->window;
         frame = wp->frame;
         XRaiseWindow(display, frame);
     } else {
@@ -485,41 +595,46 @@ void raise_and_focus_window(Window win) {
     }
 
     XSetInputFocus(display, client, RevertToPointerRoot, CurrentTime);
+    focused = find_client(client);
 
-    Atom net_active_window = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+    Atom net_active_window = wm_atoms[NET_ACTIVE_WINDOW];
     XChangeProperty(display, DefaultRootWindow(display), net_active_window,
                     XA_WINDOW, 32, PropModeReplace,
                     (unsigned char*)&client, 1);
 }
 
 
-void handle_button_press(XButtonEvent* ev) {
-    WindowPair* wp = find_framed_window(ev->window);
+void close_client(Client* c) {
+    XEvent msg = {};
+    msg.xclient.type = ClientMessage;
+    msg.xclient.message_type = wm_atoms[WM_PROTOCOLS];
+    msg.xclient.display = display;
+    msg.xclient.window = c->window;
+    msg.xclient.format = 32;
+    msg.xclient.data.l[0] = wm_atoms[WM_DELETE_WINDOW];
+    msg.xclient.data.l[1] = CurrentTime;
 
-     
-    if (!wp) {
-        for (auto& wpair : framed_windows) {
-            if (wpair.client == ev->window) {
-                wp = &wpair;
-                break;
-            }
-        }
-    }
+    XSendEvent(display, c->window, False, NoEventMask, &msg);
+}
+
+void handle_button_press(XButtonEvent* ev) {
+    Client* wp = find_client(ev->window);
+    if (wp && wp->frame == None) wp = nullptr;
 
     if (wp) {
          
         raise_and_focus_window(wp->frame);
 
                 
-        XSetInputFocus(display, wp->client, RevertToPointerRoot, CurrentTime);
+        XSetInputFocus(display, wp->window, RevertToPointerRoot, CurrentTime);
         XAllowEvents(display, ReplayPointer, CurrentTime);
 
 
          
-        Atom net_active_window = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+        Atom net_active_window = wm_atoms[NET_ACTIVE_WINDOW];
         XChangeProperty(display, DefaultRootWindow(display), net_active_window,
                         XA_WINDOW, 32, PropModeReplace,
-                        (unsigned char*)&wp->client, 1);
+                        (unsigned char*)&wp->window, 1);
 
          
         if (ev->window == wp->frame && ev->button == Button1) {
@@ -530,24 +645,20 @@ void handle_button_press(XButtonEvent* ev) {
             }
 
             if (ev->y < TITLE_BAR_HEIGHT) {
-                XWindowAttributes attr;
-                XGetWindowAttributes(display, wp->frame, &attr);
-
-                 
-                int max_x = attr.width - MAXIMIZE_BUTTON_MARGIN - MAXIMIZE_BUTTON_SIZE;
+                int max_x = wp->width - MAXIMIZE_BUTTON_MARGIN - MAXIMIZE_BUTTON_SIZE;
                 int max_y = (TITLE_BAR_HEIGHT - MAXIMIZE_BUTTON_SIZE) / 2;
 
                  
                 if (ev->x >= max_x && ev->x <= max_x + MAXIMIZE_BUTTON_SIZE &&
                     ev->y >= max_y && ev->y <= max_y + MAXIMIZE_BUTTON_SIZE) {
 
-                    Atom wm_state = XInternAtom(display, "_NET_WM_STATE", False);
-                    Atom max_vert = net_wm_state_maximized_vert;
-                    Atom max_horz = net_wm_state_maximized_horz;
+                    Atom wm_state = wm_atoms[NET_WM_STATE];
+                    Atom max_vert = wm_atoms[NET_WM_STATE_MAXIMIZED_VERT];
+                    Atom max_horz = wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ];
 
                     XEvent e = {};
                     e.xclient.type = ClientMessage;
-                    e.xclient.window = wp->client;
+                    e.xclient.window = wp->window;
                     e.xclient.message_type = wm_state;
                     e.xclient.format = 32;
                     e.xclient.data.l[0] = 2;  
@@ -562,25 +673,12 @@ void handle_button_press(XButtonEvent* ev) {
                 }
 
                  
-                int close_x = attr.width - CLOSE_BUTTON_SIZE - CLOSE_BUTTON_MARGIN;
+                int close_x = wp->width - CLOSE_BUTTON_SIZE - CLOSE_BUTTON_MARGIN;
                 int close_y = (TITLE_BAR_HEIGHT - CLOSE_BUTTON_SIZE) / 2;
 
                 if (ev->x >= close_x && ev->x <= close_x + CLOSE_BUTTON_SIZE &&
                     ev->y >= close_y && ev->y <= close_y + CLOSE_BUTTON_SIZE) {
-
-                    Atom wm_delete = XInternAtom(display, "WM_DELETE_WINDOW", False);
-                    Atom wm_protocols = XInternAtom(display, "WM_PROTOCOLS", False);
-
-                    XEvent msg = {};
-                    msg.xclient.type = ClientMessage;
-                    msg.xclient.message_type = wm_protocols;
-                    msg.xclient.display = display;
-                    msg.xclient.window = wp->client;
-                    msg.xclient.format = 32;
-                    msg.xclient.data.l[0] = wm_delete;
-                    msg.xclient.data.l[1] = CurrentTime;
-
-                    XSendEvent(display, wp->client, False, NoEventMask, &msg);
+                    close_client(wp);
                     return;
                 }
 
@@ -624,28 +722,22 @@ void handle_button_release(XButtonEvent* ev) {
             end_window_resize();
         }
         if (drag_window != None) {
-            XWindowAttributes attr;
-            XGetWindowAttributes(display, drag_window, &attr);
+            int win_x = 0, win_y = 0, win_w = 0, win_h = 0;
+            get_window_geometry(drag_window, &win_x, &win_y, &win_w, &win_h);
 
             int mon_x, mon_y, mon_w, mon_h;
-            if (!get_monitor_geometry_for_window(display, drag_window, &mon_x, &mon_y, &mon_w, &mon_h)) {
+            if (!get_monitor_geometry_for_rect(display, win_x, win_y, win_w, win_h, &mon_x, &mon_y, &mon_w, &mon_h)) {
                 mon_x = 0;
                 mon_y = 0;
                 mon_w = DisplayWidth(display, DefaultScreen(display));
                 mon_h = DisplayHeight(display, DefaultScreen(display));
             }
 
-            if (attr.y <= mon_y + 5) {
+            if (win_y <= mon_y + 5) {
                 Window client = drag_window;
+                if (Client* c = find_framed_window(drag_window)) client = c->window;
 
-                for (const auto& wp : framed_windows) {
-                    if (wp.frame == drag_window) {
-                        client = wp.client;
-                        break;
-                    }
-                }
-
-                Atom wm_state = XInternAtom(display, "_NET_WM_STATE", False);
+                Atom wm_state = wm_atoms[NET_WM_STATE];
 
                 XEvent e = {};
                 e.xclient.type = ClientMessage;
@@ -653,8 +745,8 @@ void handle_button_release(XButtonEvent* ev) {
                 e.xclient.message_type = wm_state;
                 e.xclient.format = 32;
                 e.xclient.data.l[0] = 1;
-                e.xclient.data.l[1] = net_wm_state_maximized_vert;
-                e.xclient.data.l[2] = net_wm_state_maximized_horz;
+                e.xclient.data.l[1] = wm_atoms[NET_WM_STATE_MAXIMIZED_VERT];
+                e.xclient.data.l[2] = wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ];
                 e.xclient.data.l[3] = 1;
                 e.xclient.data.l[4] = 0;
 
@@ -673,9 +765,6 @@ void handle_motion_notify(XMotionEvent* ev) {
         int dx = ev->x_root - resize_start_x;
         int dy = ev->y_root - resize_start_y;
 
-        XWindowAttributes attr;
-        XGetWindowAttributes(display, resize_window, &attr);
-
         int new_x = orig_win_x;
         int new_y = orig_win_y;
         unsigned int new_w = orig_win_w;
@@ -707,51 +796,53 @@ void handle_motion_notify(XMotionEvent* ev) {
         }
 
          
-        bool is_framed = false;
-        for (auto& wp : framed_windows) {
-            if (wp.frame == resize_window) {
-                is_framed = true;
-                XMoveResizeWindow(display, wp.frame, new_x, new_y, new_w, new_h);
-                XResizeWindow(display, wp.client, new_w, new_h - TITLE_BAR_HEIGHT);
-                break;
-            }
-        }
-        
-        if (!is_framed) {
+        Client* c = find_framed_window(resize_window);
+        if (c) {
+            XMoveResizeWindow(display, c->frame, new_x, new_y, new_w, new_h);
+            XResizeWindow(display, c->window, new_w, new_h - TITLE_BAR_HEIGHT);
+        } else {
              
             XMoveResizeWindow(display, resize_window, new_x, new_y, new_w, new_h);
+            c = find_toplevel_client(resize_window);
+        }
+
+        if (c) {
+            c->x = new_x;
+            c->y = new_y;
+            c->width = new_w;
+            c->height = new_h;
         }
     } else if (drag_in_progress && drag_window != None) {
         int new_x = ev->x_root - drag_offset_x;
         int new_y = ev->y_root - drag_offset_y;
         XMoveWindow(display, drag_window, new_x, new_y);
+
+        if (Client* c = find_toplevel_client(drag_window)) {
+            c->x = new_x;
+            c->y = new_y;
+        }
     } else {
         handle_pointer_motion(ev->window, ev->x, ev->y);
     }
 }
 
 void handle_expose(XExposeEvent* ev) {
-    auto it = std::find_if(framed_windows.begin(), framed_windows.end(),
-        [ev](const WindowPair& wp) { return wp.frame == ev->window; });
-
-    if (it != framed_windows.end()) {
+    if (find_framed_window(ev->window)) {
         draw_title_bar(ev->window);
     }
 }
 
 
 bool is_decorated(Window w) {
-    for (const auto& wp : framed_windows) {
-        if (wp.client == w) return true;
-    }
-    return false;
+    Client* c = find_client(w);
+    return c && c->window == w && c->frame != None;
 }
 
 void handle_pointer_motion(Window frame, int x, int y) {
-    WindowPair* wp = find_framed_window(frame);
-    if (!wp) return;
+    Client* c = find_framed_window(frame);
+    if (!c) return;
 
-    ResizeDirection dir = get_resize_direction(wp, x, y);
+    ResizeDirection dir = get_resize_direction(c, x, y);
     if (dir != RESIZE_NONE) {
         update_cursor(frame, dir);
     } else {
@@ -761,61 +852,49 @@ void handle_pointer_motion(Window frame, int x, int y) {
 
 void handle_property_notify(XPropertyEvent* ev) {
     if (ev->atom == XA_WM_NAME) {
-        for (const auto& wp : framed_windows) {
-            if (wp.client == ev->window) {
-                draw_title_bar(wp.frame);
-                break;
-            }
+        Client* c = find_client(ev->window);
+        if (c && c->window == ev->window && c->frame != None) {
+            update_client_title(c);
+            draw_title_bar(c->frame);
         }
     }
 }
 
 
 void handle_client_message(XClientMessageEvent* ev) {
-    if ((Atom)ev->message_type == net_wm_state && ev->format == 32) {
+    if ((Atom)ev->message_type == wm_atoms[NET_WM_STATE] && ev->format == 32) {
         Window win = ev->window;
         Atom action = ev->data.l[0];
         Atom property = (Atom)ev->data.l[1];
         Atom property2 = (Atom)ev->data.l[2];
 
         Window target_win = win;
-        bool is_framed = false;
+        Client* c = find_client(win);
+        bool is_framed = c && c->window == win && c->frame != None;
+        if (is_framed) target_win = c->frame;
 
-        for (const auto& wp : framed_windows) {
-            if (wp.client == win) {
-                target_win = wp.frame;
-                is_framed = true;
-                break;
-            }
-        }
+        int win_x = 0, win_y = 0, win_w = 0, win_h = 0;
+        get_window_geometry(target_win, &win_x, &win_y, &win_w, &win_h);
 
         int mon_x, mon_y, mon_w, mon_h;
-        if (!get_monitor_geometry_for_window(display, target_win, &mon_x, &mon_y, &mon_w, &mon_h)) {
+        if (!get_monitor_geometry_for_rect(display, win_x, win_y, win_w, win_h, &mon_x, &mon_y, &mon_w, &mon_h)) {
             mon_x = mon_y = 0;
             mon_w = DisplayWidth(display, DefaultScreen(display));
             mon_h = DisplayHeight(display, DefaultScreen(display));
         }
 
-        XWindowAttributes attr;
-        XGetWindowAttributes(display, target_win, &attr);
-
-        if (property == net_wm_state_maximized_vert || property == net_wm_state_maximized_horz ||
-            property2 == net_wm_state_maximized_vert || property2 == net_wm_state_maximized_horz) {
+        if (property == wm_atoms[NET_WM_STATE_MAXIMIZED_VERT] || property == wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ] ||
+            property2 == wm_atoms[NET_WM_STATE_MAXIMIZED_VERT] || property2 == wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ]) {
 
-            bool is_maximized = (attr.width == mon_w && attr.height == mon_h);
+            bool is_maximized = (win_w == mon_w && win_h == mon_h);
 
             if (action == 1 || (action == 2 && !is_maximized)) {
                 XMoveResizeWindow(display, target_win, mon_x, mon_y, mon_w, mon_h);
                 if (is_framed) {
-                    for (auto& wp : framed_windows) {
-                        if (wp.frame == target_win) {
-                            XResizeWindow(display, wp.client, mon_w, mon_h - TITLE_BAR_HEIGHT);
-                            break;
-                        }
-                    }
+                    XResizeWindow(display, c->window, mon_w, mon_h - TITLE_BAR_HEIGHT);
                 }
-                Atom data[2] = { net_wm_state_maximized_vert, net_wm_state_maximized_horz };
-                XChangeProperty(display, win, net_wm_state, XA_ATOM, 32, PropModeReplace,
+                Atom data[2] = { wm_atoms[NET_WM_STATE_MAXIMIZED_VERT], wm_atoms[NET_WM_STATE_MAXIMIZED_HORZ] };
+                XChangeProperty(display, win, wm_atoms[NET_WM_STATE], XA_ATOM, 32, PropModeReplace,
                                 reinterpret_cast<unsigned char*>(data), 2);
             } else if (action == 0 || (action == 2 && is_maximized)) {
                 int default_w = 800;
@@ -825,35 +904,25 @@ void handle_client_message(XClientMessageEvent* ev) {
 
                 XMoveResizeWindow(display, target_win, default_x, default_y, default_w, default_h);
                 if (is_framed) {
-                    for (auto& wp : framed_windows) {
-                        if (wp.frame == target_win) {
-                            XResizeWindow(display, wp.client, default_w, default_h - TITLE_BAR_HEIGHT);
-                            break;
-                        }
-                    }
+                    XResizeWindow(display, c->window, default_w, default_h - TITLE_BAR_HEIGHT);
                 }
 
-                XDeleteProperty(display, win, net_wm_state);
+                XDeleteProperty(display, win, wm_atoms[NET_WM_STATE]);
             }
 
 
-        } else if (property == net_wm_state_fullscreen) {
-            bool already_fullscreen = (attr.x == mon_x && attr.y == mon_y &&
-                                       attr.width == mon_w && attr.height == mon_h);
+        } else if (property == wm_atoms[NET_WM_STATE_FULLSCREEN]) {
+            bool already_fullscreen = (win_x == mon_x && win_y == mon_y &&
+                                       win_w == mon_w && win_h == mon_h);
 
             if (action == 1 || (action == 2 && !already_fullscreen)) {
                 XMoveResizeWindow(display, target_win, mon_x, mon_y, mon_w, mon_h);
                 if (is_framed) {
-                    for (const auto& wp : framed_windows) {
-                        if (wp.frame == target_win) {
-                            XResizeWindow(display, wp.client, mon_w, mon_h - TITLE_BAR_HEIGHT);
-                            break;
-                        }
-                    }
+                    XResizeWindow(display, c->window, mon_w, mon_h - TITLE_BAR_HEIGHT);
                 }
 
-                Atom data[2] = { net_wm_state_fullscreen, None };
-                XChangeProperty(display, win, net_wm_state, XA_ATOM, 32, PropModeReplace,
+                Atom data[2] = { wm_atoms[NET_WM_STATE_FULLSCREEN], None };
+                XChangeProperty(display, win, wm_atoms[NET_WM_STATE], XA_ATOM, 32, PropModeReplace,
                                 reinterpret_cast<unsigned char*>(data), 1);
             } else if (action == 0 || (action == 2 && already_fullscreen)) {
                 int default_w = 800;
@@ -863,40 +932,24 @@ void handle_client_message(XClientMessageEvent* ev) {
 
                 XMoveResizeWindow(display, target_win, default_x, default_y, default_w, default_h);
                 if (is_framed) {
-                    for (const auto& wp : framed_windows) {
-                        if (wp.frame == target_win) {
-                            XResizeWindow(display, wp.client, default_w, default_h - TITLE_BAR_HEIGHT);
-                            break;
-                        }
-                    }
+                    XResizeWindow(display, c->window, default_w, default_h - TITLE_BAR_HEIGHT);
                 }
 
-                XDeleteProperty(display, win, net_wm_state);
+                XDeleteProperty(display, win, wm_atoms[NET_WM_STATE]);
             }
         }
     }
 
-    static Atom net_wm_moveresize = XInternAtom(display, "_NET_WM_MOVERESIZE", False);
-    if ((Atom)ev->message_type == net_wm_moveresize && ev->format == 32) {
+    if ((Atom)ev->message_type == wm_atoms[NET_WM_MOVERESIZE] && ev->format == 32) {
         int x_root = ev->data.l[0];
         int y_root = ev->data.l[1];
         int direction = ev->data.l[2];
 
         Window client = ev->window;
         Window target_window = client;
-        bool is_framed = false;
-
-        for (auto& wp : framed_windows) {
-            if (wp.client == client) {
-                target_window = wp.frame;
-                is_framed = true;
-                break;
-            }
-        }
-
-        XWindowAttributes attr;
-        if (!XGetWindowAttributes(display, client, &attr)) return;
-        if (attr.override_redirect || attr.map_state != IsViewable) return;
+        Client* c = find_client(client);
+        if (!c || c->window != client || !c->mapped) return;
+        if (c->frame != None) target_window = c->frame;
 
         if (direction == 8 /* _NET_WM_MOVERESIZE_MOVE */) {
             start_window_drag(target_window, x_root, y_root);
@@ -906,3 +959,152 @@ void handle_client_message(XClientMessageEvent* ev) {
         }
     }
 }
+
+void handle_configure_notify(XConfigureEvent* ev) {
+    Client* c = find_toplevel_client(ev->window);
+    if (!c) return;
+
+    c->x = ev->x;
+    c->y = ev->y;
+    c->width = ev->width;
+    c->height = ev->height;
+}
+
+void handle_configure_request(XConfigureRequestEvent* req) {
+    XWindowChanges changes;
+    changes.x = req->x;
+    changes.y = req->y;
+    changes.width = req->width;
+    changes.height = req->height;
+    changes.border_width = req->border_width;
+    changes.sibling = req->above;
+    changes.stack_mode = req->detail;
+
+    XConfigureWindow(display, req->window, req->value_mask, &changes);
+}
+
+void handle_map_notify(XMapEvent* ev) {
+    Client* c = find_client(ev->window);
+    if (c && c->window == ev->window) c->mapped = true;
+}
+
+void handle_unmap_notify(XUnmapEvent* ev) {
+    Client* c = find_client(ev->window);
+    if (c && c->window == ev->window) {
+        c->mapped = false;
+        if (focused == c) focused = nullptr;
+    }
+}
+
+void handle_focus_in(XFocusChangeEvent* ev) {
+    if (ev->mode == NotifyGrab || ev->mode == NotifyUngrab) return;
+    if (ev->detail == NotifyPointer) return;
+
+    Client* c = find_client(ev->window);
+    if (c && c->window == ev->window) focused = c;
+}
+
+void handle_focus_out(XFocusChangeEvent* ev) {
+    if (ev->mode == NotifyGrab || ev->mode == NotifyUngrab) return;
+    if (ev->detail == NotifyPointer || ev->detail == NotifyInferior) return;
+
+    Client* c = find_client(ev->window);
+    if (c && focused == c) focused = nullptr;
+}
+
+// Managed client holding the keyboard focus. Falls back to asking the server
+// when nothing is tracked, e.g. after the focused window went away and the
+// keyboard follows the pointer.
+Client* focused_client() {
+    if (focused) return focused;
+
+    Window focus;
+    int revert;
+    XGetInputFocus(display, &focus, &revert);
+
+    if (focus == PointerRoot) {
+        Window root_return, child;
+        int rx, ry, wx, wy;
+        unsigned int mask;
+        if (!XQueryPointer(display, DefaultRootWindow(display), &root_return, &child,
+                           &rx, &ry, &wx, &wy, &mask)) return nullptr;
+        focus = child;
+    }
+
+    // Toolkits often focus a child of their top-level, so walk up until a
+    // known window turns up.
+    while (focus != None && focus != PointerRoot) {
+        if (Client* c = find_client(focus)) return c;
+
+        Window root_return, parent;
+        Window* children;
+        unsigned int nchildren;
+        if (!XQueryTree(display, focus, &root_return, &parent, &children, &nchildren)) break;
+        if (children) XFree(children);
+        if (parent == root_return) break;
+        focus = parent;
+    }
+    return nullptr;
+}
+
+// Toggles a _NET_WM_STATE pair on c the same way a client request would.
+void toggle_client_state(Client* c, Atom first, Atom second) {
+    XClientMessageEvent msg = {};
+    msg.type = ClientMessage;
+    msg.display = display;
+    msg.window = c->window;
+    msg.message_type = wm_atoms[NET_WM_STATE];
+    msg.format = 32;
+    msg.data.l[0] = 2;
+    msg.data.l[1] = first;
+    msg.data.l[2] = second;
+    handle_client_message(&msg);
+}
+
+// Moves c to monitor index (or the one after its current monitor when index
+// is negative), keeping its offset within the monitor where it fits.
+void move_client_to_monitor(Client* c, int index) {
+    const std::vector<Monitor>& monitors = get_monitors(display);
+    if (monitors.empty()) return;
+
+    const Monitor* current = monitor_for_rect(display, c->x, c->y, c->width, c->height);
+    if (index < 0) {
+        index = current ? (int)(current - monitors.data()) + 1 : 0;
+        index %= (int)monitors.size();
+    }
+    if (index >= (int)monitors.size()) return;
+
+    const Monitor& target = monitors[index];
+    int x = target.x + (current ? c->x - current->x : 0);
+    int y = target.y + (current ? c->y - current->y : 0);
+    x = std::max(target.x, std::min(x, target.x + target.width - c->width));
+    y = std::max(target.y, std::min(y, target.y + target.height - c->height));
+
+    move_resize_client(c, x, y, c->width, c->height);
+}
+
+// Focuses the next mapped client after the focused one, in mapping order.
+void focus_next_client() {
+    std::list<Client>& clients = all_clients();
+    if (clients.empty()) return;
+
+    Client* current = focused_client();
+    auto start = clients.begin();
+    if (current) {
+        for (auto it = clients.begin(); it != clients.end(); ++it) {
+            if (&*it == current) {
+                start = std::next(it);
+                break;
+            }
+        }
+    }
+
+    auto it = start;
+    for (size_t i = 0; i < clients.size(); ++i, ++it) {
+        if (it == clients.end()) it = clients.begin();
+        if (&*it != current && it->mapped) {
+            raise_and_focus_window(it->frame != None ? it->frame : it->window);
+            return;
+        }
+    }
+}
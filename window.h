@@ -1,6 +1,8 @@
 #pragma once
 
 #include <X11/Xlib.h>
+
+struct Client;
  
 void handle_map_request(XMapRequestEvent* ev);
 void handle_destroy_notify(XDestroyWindowEvent* ev);
@@ -9,21 +11,51 @@ void handle_motion_notify(XMotionEvent* ev);
 void handle_button_release(XButtonEvent* ev);
 void handle_expose(XExposeEvent* ev);
 void init_atoms();
+void init_decorations();
 void handle_client_message(XClientMessageEvent* ev);
 void handle_property_notify(XPropertyEvent* ev);
+void handle_configure_notify(XConfigureEvent* ev);
+void handle_configure_request(XConfigureRequestEvent* req);
+void handle_map_notify(XMapEvent* ev);
+void handle_unmap_notify(XUnmapEvent* ev);
+void handle_focus_in(XFocusChangeEvent* ev);
+void handle_focus_out(XFocusChangeEvent* ev);
+
+void move_resize_client(Client* c, int x, int y, int width, int height);
+void close_client(Client* c);
+Client* focused_client();
+void toggle_client_state(Client* c, Atom first, Atom second);
+void move_client_to_monitor(Client* c, int index);
+void focus_next_client();
 
 void start_window_drag(Window win, int x_root, int y_root);
 void end_window_drag();
 
 extern bool drag_in_progress;
+extern bool resize_in_progress;
 extern Window drag_window;
 extern int drag_offset_x;
 extern int drag_offset_y;
 
-extern Atom net_wm_state;
-extern Atom net_wm_state_fullscreen;
-extern Atom net_wm_state_maximized_vert;
-extern Atom net_wm_state_maximized_horz;
+enum AtomId {
+    NET_WM_STATE,
+    NET_WM_STATE_FULLSCREEN,
+    NET_WM_STATE_MAXIMIZED_VERT,
+    NET_WM_STATE_MAXIMIZED_HORZ,
+    NET_WM_MOVERESIZE,
+    NET_CLIENT_LIST,
+    NET_ACTIVE_WINDOW,
+    MOTIF_WM_HINTS,
+    WM_PROTOCOLS,
+    WM_DELETE_WINDOW,
+    WM_CLIENT_LEADER,
+    XROOTPMAP_ID,
+    ESETROOT_PMAP_ID,
+    NET_WM_PID,
+    ATOM_COUNT
+};
+
+extern Atom wm_atoms[ATOM_COUNT];
 
 
 